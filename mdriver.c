@@ -0,0 +1,634 @@
+/*
+ * mdriver.c - Trace-driven benchmark driver for the memory manager.
+ *
+ * Replays allocation traces against mm_malloc, mm_free and mm_realloc on
+ * top of the simulated heap in memlib.c, and reports for every trace:
+ *
+ *   - whether the replay was valid: no NULL returns, aligned blocks, and
+ *     payloads that survive until their block is freed or reallocated;
+ *   - peak utilization: the most live payload at any point over the most
+ *     memory the allocator held at any point (mm_footprint);
+ *   - throughput, from the best of several untimed replays;
+ *   - p50/p99/p999 latency of single operations, from one replay that
+ *     reads the clock around every operation;
+ *   - how many allocations the thread cache served, and how many times
+ *     the heap was extended, from mm_stats.
+ *
+ * Traces use the CS:APP malloc lab format. Four header lines (suggested
+ * heap size, number of ids, number of operations, weight) are followed
+ * by one operation per line:
+ *
+ *   a <id> <size>	allocate size bytes as block id
+ *   r <id> <size>	reallocate block id to size bytes
+ *   f <id>		free block id
+ *
+ * Usage: mdriver [-ls] [-c classfile] [-r reps] [-t tracedir] [-f tracefile]...
+ *   -f	replay this trace; may be given more than once
+ *   -t	replay every .rep file in this directory (default ./traces)
+ *   -r	throughput replays per trace, best is kept (default 3)
+ *   -l	also replay against the C library malloc, for comparison
+ *   -c	lay the free lists out by this size class table from mkclasses
+ *   -s	after the checked replay, print how the free list searches went,
+ *	and how far they walked down their own lists
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define ALIGNMENT	8	/* Every block must be aligned to this */
+#define MAXLINE		1024	/* Longest trace line or file name */
+#define MAXTRACES	256	/* Most traces one run may replay */
+#define MAXCLASSES	1024	/* Most classes a class table may have */
+#define DEFAULT_DIR	"./traces"
+
+/* One trace operation */
+typedef struct {
+	enum { ALLOC, FREE, REALLOC } type;
+	int index;		/* Block id */
+	size_t size;		/* Bytes for ALLOC and REALLOC */
+} traceop_t;
+
+/* A whole trace, and room for the blocks it has live */
+typedef struct {
+	const char *name;
+	int num_ids;
+	int num_ops;
+	traceop_t *ops;
+	char **blocks;		/* Live block of each id, NULL if none */
+	size_t *sizes;		/* Payload size of each live block */
+} trace_t;
+
+/* The allocator being replayed */
+typedef struct {
+	const char *name;
+	int (*init)(void);
+	void *(*malloc)(size_t size);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t size);
+} impl_t;
+
+/* Results for one trace */
+typedef struct {
+	int valid;
+	double util;		/* Peak live payload / peak footprint */
+	double secs;		/* Best replay time */
+	double p50, p99, p999;	/* Per-operation latency, ns */
+} stats_t;
+
+static int mm_reset(void);
+static int libc_init(void);
+
+static impl_t mm_impl = { "mm", mm_reset, mm_malloc, mm_free, mm_realloc };
+static impl_t libc_impl = { "libc", libc_init, malloc, free, realloc };
+
+/* Function prototypes for internal helper routines */
+static trace_t *read_trace(const char *file);
+static void free_trace(trace_t *trace);
+static int find_traces(const char *dir, char **names);
+static int name_cmp(const void *a, const void *b);
+static int eval_valid(trace_t *trace, double *util);
+static double eval_speed(impl_t *impl, trace_t *trace);
+static void eval_latency(impl_t *impl, trace_t *trace, stats_t *stats);
+static int replay_op(impl_t *impl, trace_t *trace, traceop_t *op);
+static void release_all(impl_t *impl, trace_t *trace);
+static int lat_cmp(const void *a, const void *b);
+static double now(void);
+static void print_stats(const char *impl, const char *trace, int ops, stats_t *stats, int has_util);
+static void print_fits(struct mm_stats *st);
+static void print_cache(struct mm_stats *st);
+static void print_grows(struct mm_stats *st);
+static void print_reallocs(struct mm_stats *st);
+static int load_classes(const char *file);
+static void usage(const char *prog);
+
+int main(int argc, char **argv)
+{
+	char *names[MAXTRACES];
+	int ntraces = 0, reps = 3, use_libc = 0, show_fits = 0, i, r, c;
+	const char *dir = DEFAULT_DIR;
+	long total_ops = 0, libc_ops = 0;
+	double total_secs = 0, libc_secs = 0, util_sum = 0;
+	int all_valid = 1;
+	trace_t *trace;
+	stats_t stats;
+	struct mm_stats counts;
+	double secs;
+
+	while ((c = getopt(argc, argv, "f:t:r:c:lsh")) != -1) {
+		switch (c) {
+		case 'f':
+			if (ntraces == MAXTRACES) {
+				fprintf(stderr, "Too many traces, at most %d\n", MAXTRACES);
+				exit(1);
+			}
+			names[ntraces++] = strdup(optarg);
+			break;
+		case 't':
+			dir = optarg;
+			break;
+		case 'r':
+			if ((reps = atoi(optarg)) < 1)
+				usage(argv[0]);
+			break;
+		case 'l':
+			use_libc = 1;
+			break;
+		case 'c':
+			if (load_classes(optarg) < 0)
+				exit(1);
+			break;
+		case 's':
+			show_fits = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (ntraces == 0 && (ntraces = find_traces(dir, names)) == 0) {
+		fprintf(stderr, "No traces found in %s\n", dir);
+		exit(1);
+	}
+
+	printf("Team: %s\n", team.teamname);
+	mem_init();
+	printf("\n%-8s %-20s %8s %6s %7s %10s %8s %8s %8s\n", "impl", "trace",
+		"ops", "valid", "util", "Kops/s", "p50 ns", "p99 ns", "p999 ns");
+	for (i = 0; i < ntraces; i++) {
+		if ((trace = read_trace(names[i])) == NULL)
+			exit(1);
+
+		memset(&stats, 0, sizeof(stats));
+		stats.valid = eval_valid(trace, &stats.util);
+		stats.secs = 0;
+		if (stats.valid)
+			mm_stats(&counts);
+		if (stats.valid) {
+			for (r = 0; r < reps; r++) {
+				secs = eval_speed(&mm_impl, trace);
+				if (r == 0 || secs < stats.secs)
+					stats.secs = secs;
+			}
+			eval_latency(&mm_impl, trace, &stats);
+			total_ops += trace->num_ops;
+			total_secs += stats.secs;
+			util_sum += stats.util;
+		}
+		else
+			all_valid = 0;
+		print_stats(mm_impl.name, trace->name, trace->num_ops, &stats, 1);
+		if (stats.valid) {
+			print_cache(&counts);
+			print_grows(&counts);
+		}
+		if (show_fits && stats.valid)
+			print_fits(&counts);
+		if (stats.valid && counts.realloc_inplace + counts.realloc_copies > 0)
+			print_reallocs(&counts);
+
+		if (use_libc) {
+			memset(&stats, 0, sizeof(stats));
+			stats.valid = 1;
+			for (r = 0; r < reps; r++) {
+				secs = eval_speed(&libc_impl, trace);
+				if (r == 0 || secs < stats.secs)
+					stats.secs = secs;
+			}
+			eval_latency(&libc_impl, trace, &stats);
+			libc_ops += trace->num_ops;
+			libc_secs += stats.secs;
+			print_stats(libc_impl.name, trace->name, trace->num_ops, &stats, 0);
+		}
+		free_trace(trace);
+	}
+
+	printf("\nmm:   %ld ops in %.3f s, %.0f Kops/s", total_ops, total_secs,
+		total_secs > 0 ? total_ops / total_secs / 1e3 : 0.0);
+	if (all_valid)
+		printf(", mean util %.1f%%\n", 100.0 * util_sum / ntraces);
+	else
+		printf(", some traces INVALID\n");
+	if (use_libc)
+		printf("libc: %ld ops in %.3f s, %.0f Kops/s\n", libc_ops, libc_secs,
+			libc_secs > 0 ? libc_ops / libc_secs / 1e3 : 0.0);
+
+	for (i = 0; i < ntraces; i++)
+		free(names[i]);
+	mem_deinit();
+	return all_valid ? 0 : 1;
+}
+
+/*
+ * mm_reset - Start the memory manager on an empty heap.
+ */
+static int mm_reset(void)
+{
+	mem_reset_brk();
+	return mm_init();
+}
+
+static int libc_init(void)
+{
+	return 0;
+}
+
+/*
+ * read_trace - Read a trace file, or print why not and return NULL.
+ */
+static trace_t *read_trace(const char *file)
+{
+	FILE *fp;
+	trace_t *trace;
+	char type[MAXLINE];
+	int heap_size, weight, index, ops = 0;
+	unsigned long size;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "Could not open %s\n", file);
+		return NULL;
+	}
+	trace = calloc(1, sizeof(trace_t));
+	trace->name = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+	if (fscanf(fp, "%d %d %d %d", &heap_size, &trace->num_ids,
+		&trace->num_ops, &weight) != 4 || trace->num_ids < 0 || trace->num_ops < 0) {
+		fprintf(stderr, "%s: bad trace header\n", file);
+		fclose(fp);
+		free(trace);
+		return NULL;
+	}
+	trace->ops = calloc(trace->num_ops + 1, sizeof(traceop_t));
+	trace->blocks = calloc(trace->num_ids + 1, sizeof(char *));
+	trace->sizes = calloc(trace->num_ids + 1, sizeof(size_t));
+
+	while (ops < trace->num_ops && fscanf(fp, "%1023s", type) == 1) {
+		traceop_t *op = &trace->ops[ops];
+
+		if (type[0] == 'a' || type[0] == 'r') {
+			if (fscanf(fp, "%d %lu", &index, &size) != 2)
+				break;
+			op->type = type[0] == 'a' ? ALLOC : REALLOC;
+			op->size = size;
+		}
+		else if (type[0] == 'f') {
+			if (fscanf(fp, "%d", &index) != 1)
+				break;
+			op->type = FREE;
+		}
+		else {
+			fprintf(stderr, "%s: bad operation '%s' at op %d\n", file, type, ops);
+			ops = -1;
+			break;
+		}
+		if (index < 0 || index >= trace->num_ids) {
+			fprintf(stderr, "%s: id %d out of range at op %d\n", file, index, ops);
+			ops = -1;
+			break;
+		}
+		op->index = index;
+		ops++;
+	}
+	fclose(fp);
+	if (ops != trace->num_ops) {
+		if (ops >= 0)
+			fprintf(stderr, "%s: %d of %d operations read\n", file, ops, trace->num_ops);
+		free_trace(trace);
+		return NULL;
+	}
+	return trace;
+}
+
+static void free_trace(trace_t *trace)
+{
+	free(trace->ops);
+	free(trace->blocks);
+	free(trace->sizes);
+	free(trace);
+}
+
+/*
+ * find_traces - Fill names with every .rep file in dir, sorted, and
+ * return how many there are.
+ */
+static int find_traces(const char *dir, char **names)
+{
+	DIR *dp;
+	struct dirent *de;
+	size_t len;
+	int n = 0;
+
+	if ((dp = opendir(dir)) == NULL)
+		return 0;
+	while ((de = readdir(dp)) != NULL && n < MAXTRACES) {
+		len = strlen(de->d_name);
+		if (len < 5 || strcmp(de->d_name + len - 4, ".rep") != 0)
+			continue;
+		names[n] = malloc(strlen(dir) + len + 2);
+		sprintf(names[n], "%s/%s", dir, de->d_name);
+		n++;
+	}
+	closedir(dp);
+	qsort(names, n, sizeof(char *), name_cmp);
+	return n;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * eval_valid - Replay the trace against mm, checking every block as it
+ * goes, and work out peak utilization. Returns 1 if the replay was
+ * valid, else prints what went wrong and returns 0.
+ */
+static int eval_valid(trace_t *trace, double *util)
+{
+	size_t live = 0, peak_live = 0, footprint, peak_footprint = 0;
+	size_t oldsize, k;
+	int i, index;
+	char *p;
+
+	if (mm_reset() < 0) {
+		fprintf(stderr, "%s: mm_init failed\n", trace->name);
+		return 0;
+	}
+	memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+	for (i = 0; i < trace->num_ops; i++) {
+		traceop_t *op = &trace->ops[i];
+
+		index = op->index;
+		p = trace->blocks[index];
+		oldsize = trace->sizes[index];
+
+		/* The payload must still hold the byte it was filled with */
+		if (p != NULL && op->type != ALLOC) {
+			for (k = 0; k < oldsize; k++)
+				if (p[k] != (char)index) {
+					fprintf(stderr, "%s: op %d: block %d overwritten at byte %lu\n",
+						trace->name, i, index, (unsigned long)k);
+					release_all(&mm_impl, trace);
+					return 0;
+				}
+		}
+
+		if (replay_op(&mm_impl, trace, op) < 0) {
+			fprintf(stderr, "%s: op %d: %s of %lu bytes returned NULL\n", trace->name, i,
+				op->type == ALLOC ? "mm_malloc" : "mm_realloc", (unsigned long)op->size);
+			release_all(&mm_impl, trace);
+			return 0;
+		}
+		if (op->type == FREE) {
+			live -= oldsize;
+			continue;
+		}
+
+		p = trace->blocks[index];
+		if (p != NULL && ((unsigned long)p & (ALIGNMENT-1)) != 0) {
+			fprintf(stderr, "%s: op %d: block %d at %p is not %d-byte aligned\n",
+				trace->name, i, index, p, ALIGNMENT);
+			release_all(&mm_impl, trace);
+			return 0;
+		}
+		if (p != NULL)
+			memset(p, (char)index, op->size);
+		live += op->size - (op->type == REALLOC ? oldsize : 0);
+		if (live > peak_live)
+			peak_live = live;
+		if ((footprint = mm_footprint()) > peak_footprint)
+			peak_footprint = footprint;
+	}
+	release_all(&mm_impl, trace);
+	*util = peak_footprint ? (double)peak_live / peak_footprint : 0;
+	return 1;
+}
+
+/*
+ * eval_speed - Replay the trace once, without checks, and return how
+ * many seconds it took.
+ */
+static double eval_speed(impl_t *impl, trace_t *trace)
+{
+	double start;
+	int i;
+
+	impl->init();
+	memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+	start = now();
+	for (i = 0; i < trace->num_ops; i++)
+		replay_op(impl, trace, &trace->ops[i]);
+	start = now() - start;
+	release_all(impl, trace);
+	return start;
+}
+
+/*
+ * eval_latency - Replay the trace once, timing every operation, and
+ * fill in the latency percentiles. The clock reads themselves add a
+ * few tens of nanoseconds to each sample.
+ */
+static void eval_latency(impl_t *impl, trace_t *trace, stats_t *stats)
+{
+	double *lat = malloc((trace->num_ops + 1) * sizeof(double));
+	double start;
+	int i, n = trace->num_ops;
+
+	impl->init();
+	memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+	for (i = 0; i < n; i++) {
+		start = now();
+		replay_op(impl, trace, &trace->ops[i]);
+		lat[i] = (now() - start) * 1e9;
+	}
+	release_all(impl, trace);
+
+	if (n > 0) {
+		qsort(lat, n, sizeof(double), lat_cmp);
+		stats->p50 = lat[(long)(n * 0.50)];
+		stats->p99 = lat[(long)(n * 0.99)];
+		stats->p999 = lat[(long)(n * 0.999)];
+	}
+	free(lat);
+}
+
+/*
+ * replay_op - Carry out one operation. Returns -1 if an allocation
+ * failed, else 0.
+ */
+static int replay_op(impl_t *impl, trace_t *trace, traceop_t *op)
+{
+	char *p;
+
+	switch (op->type) {
+	case ALLOC:
+		p = impl->malloc(op->size);
+		break;
+	case REALLOC:
+		p = impl->realloc(trace->blocks[op->index], op->size);
+		break;
+	default:
+		impl->free(trace->blocks[op->index]);
+		trace->blocks[op->index] = NULL;
+		trace->sizes[op->index] = 0;
+		return 0;
+	}
+	if (p == NULL && op->size > 0)
+		return -1;
+	trace->blocks[op->index] = p;
+	trace->sizes[op->index] = op->size;
+	return 0;
+}
+
+/*
+ * release_all - Free whatever blocks the trace left live, so mappings
+ * do not outlast the heap they came with.
+ */
+static void release_all(impl_t *impl, trace_t *trace)
+{
+	int i;
+
+	for (i = 0; i < trace->num_ids; i++) {
+		if (trace->blocks[i] != NULL)
+			impl->free(trace->blocks[i]);
+		trace->blocks[i] = NULL;
+		trace->sizes[i] = 0;
+	}
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_stats(const char *impl, const char *trace, int ops, stats_t *stats, int has_util)
+{
+	char util[16];
+
+	if (has_util && stats->valid)
+		sprintf(util, "%.1f%%", 100.0 * stats->util);
+	else
+		strcpy(util, "-");
+	printf("%-8s %-20s %8d %6s %7s ", impl, trace, ops, stats->valid ? "yes" : "no", util);
+	if (!stats->valid) {
+		printf("%10s %8s %8s %8s\n", "-", "-", "-", "-");
+		return;
+	}
+	printf("%10.0f %8.0f %8.0f %8.0f\n", stats->secs > 0 ? ops / stats->secs / 1e3 : 0.0,
+		stats->p50, stats->p99, stats->p999);
+}
+
+/*
+ * print_fits - Print the free list search counters of the checked replay:
+ * searches that found a block, how many found it in the list of their
+ * own size, and how many bytes over the request the blocks were. Then
+ * the walks down a search's own list, by how many blocks each looked at.
+ */
+static void print_fits(struct mm_stats *st)
+{
+	unsigned long walks = 0;
+	int i;
+
+	printf("%-8s %-20s %8lu fits, %.1f%% own list, %.1f bytes mean excess\n", "", "",
+		st->fits, st->fits ? 100.0 * st->fit_exact / st->fits : 0.0,
+		st->fits ? (double)st->fit_excess / st->fits : 0.0);
+	for (i = 0; i <= MM_FIT_SCAN; i++)
+		walks += st->fit_scans[i];
+	printf("%-8s %-20s %8lu list walks, by blocks looked at:", "", "", walks);
+	for (i = 0; i <= MM_FIT_SCAN; i++)
+		printf(" %d:%lu", i, st->fit_scans[i]);
+	printf("\n");
+}
+
+/*
+ * print_cache - Print how the checked replay's cacheable allocations
+ * went: served from the thread cache, or sent on to the free lists.
+ */
+static void print_cache(struct mm_stats *st)
+{
+	unsigned long tries = st->tcache_hits + st->tcache_misses;
+
+	printf("%-8s %-20s %8lu tcache hits, %lu misses, %.1f%% hit rate\n", "", "",
+		st->tcache_hits, st->tcache_misses, tries ? 100.0 * st->tcache_hits / tries : 0.0);
+}
+
+/*
+ * print_grows - Print how many times the checked replay grew the heap,
+ * and the most memory it held.
+ */
+static void print_grows(struct mm_stats *st)
+{
+	printf("%-8s %-20s %8lu heap extensions, %lu bytes peak footprint\n", "", "",
+		st->extends, (unsigned long)st->peak_heap_bytes);
+}
+
+/*
+ * print_reallocs - Print what the checked replay's mm_realloc calls did:
+ * how many resized in place and how many copied, and the payload bytes
+ * copied against those resizing in place kept where they were.
+ */
+static void print_reallocs(struct mm_stats *st)
+{
+	printf("%-8s %-20s %8lu in place, %lu copied, %lu bytes copied, %lu kept in place\n", "", "",
+		st->realloc_inplace, st->realloc_copies, st->realloc_copied, st->realloc_saved);
+}
+
+/*
+ * load_classes - Read a size class table, one request size per line with
+ * # comments, and hand it to mm_size_classes. Returns -1, after saying
+ * why, if it cannot.
+ */
+static int load_classes(const char *file)
+{
+	static size_t bounds[MAXCLASSES];
+	char line[MAXLINE];
+	FILE *fp;
+	int n = 0;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "Could not open %s\n", file);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+		if (n == MAXCLASSES) {
+			fprintf(stderr, "%s: more than %d classes\n", file, MAXCLASSES);
+			fclose(fp);
+			return -1;
+		}
+		bounds[n++] = strtoul(line, NULL, 0);
+	}
+	fclose(fp);
+	if (mm_size_classes(bounds, n) < 0) {
+		fprintf(stderr, "%s: mm_size_classes refused the table\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-ls] [-c classfile] [-r reps] [-t tracedir] [-f tracefile]...\n", prog);
+	fprintf(stderr, "  -f <file>  Replay this trace; may be given more than once\n");
+	fprintf(stderr, "  -t <dir>   Replay every .rep file in dir (default %s)\n", DEFAULT_DIR);
+	fprintf(stderr, "  -r <n>     Throughput replays per trace, best kept (default 3)\n");
+	fprintf(stderr, "  -l         Also replay against the C library malloc\n");
+	fprintf(stderr, "  -c <file>  Lay the free lists out by this mkclasses table\n");
+	fprintf(stderr, "  -s         Print how the free list searches went\n");
+	exit(1);
+}
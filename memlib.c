@@ -0,0 +1,127 @@
+/*
+ * memlib.c - Simulated heap for the memory manager.
+ *
+ * The whole MAX_HEAP range is reserved with one mmap when mem_init is
+ * called, and mem_sbrk moves a break pointer inside it, so the heap is
+ * always contiguous. Pages are only backed once touched.
+ *
+ * Memory handed out by mem_sbrk is always zero: fresh pages are zero,
+ * and memory given back with a negative increment or mem_reset_brk is
+ * zeroed before it can be handed out again. mm.c may be built with
+ * SBRK_ZEROED and MEM_SBRK_SHRINKS set to match.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+static char *mem_start_brk;	/* First byte of the heap */
+static char *mem_brk;		/* Last byte of the heap plus one */
+static char *mem_max_addr;	/* Largest legal heap address plus one */
+
+/* Zero [lo, hi), dropping the whole pages rather than writing them */
+static void mem_zero(char *lo, char *hi);
+
+/*
+ * mem_init - Reserve the address space for the simulated heap.
+ */
+void mem_init(void)
+{
+	mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem_start_brk == MAP_FAILED) {
+		fprintf(stderr, "mem_init: mmap error: %s\n", strerror(errno));
+		exit(1);
+	}
+	mem_brk = mem_start_brk;
+	mem_max_addr = mem_start_brk + MAX_HEAP;
+}
+
+/*
+ * mem_deinit - Give the whole reservation back.
+ */
+void mem_deinit(void)
+{
+	munmap(mem_start_brk, MAX_HEAP);
+	mem_start_brk = mem_brk = mem_max_addr = NULL;
+}
+
+/*
+ * mem_reset_brk - Reset the break to an empty heap.
+ */
+void mem_reset_brk(void)
+{
+	mem_zero(mem_start_brk, mem_brk);
+	mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - Move the break by incr bytes and return its old value, or
+ * (void *)-1 if the heap would leave its reservation. A negative incr
+ * gives memory back.
+ */
+void *mem_sbrk(int incr)
+{
+	char *old_brk = mem_brk;
+
+	if ((incr < 0 && -(long)incr > mem_brk - mem_start_brk) ||
+		(incr > 0 && incr > mem_max_addr - mem_brk)) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	mem_brk += incr;
+	if (incr < 0)
+		mem_zero(mem_brk, old_brk);
+	return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - Return the address of the first heap byte.
+ */
+void *mem_heap_lo(void)
+{
+	return (void *)mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - Return the address of the last heap byte.
+ */
+void *mem_heap_hi(void)
+{
+	return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize - Return the heap size in bytes.
+ */
+size_t mem_heapsize(void)
+{
+	return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize - Return the system's page size.
+ */
+size_t mem_pagesize(void)
+{
+	return (size_t)getpagesize();
+}
+
+static void mem_zero(char *lo, char *hi)
+{
+	size_t page = mem_pagesize();
+	char *start = (char *)(((unsigned long)lo + (page-1)) & ~(unsigned long)(page-1));
+	char *end = (char *)((unsigned long)hi & ~(unsigned long)(page-1));
+
+	if (end <= start) {
+		memset(lo, 0, hi - lo);
+		return;
+	}
+	memset(lo, 0, start - lo);
+	madvise(start, end - start, MADV_DONTNEED);
+	memset(end, 0, hi - end);
+}
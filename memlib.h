@@ -0,0 +1,19 @@
+/*
+ * memlib.h - Simulated heap for the memory manager, in the style of the
+ * CS:APP malloc lab. mm.c gets all of its heap through mem_sbrk.
+ */
+#include <unistd.h>
+
+/* Most bytes the simulated heap may grow to */
+#ifndef MAX_HEAP
+#define MAX_HEAP	((size_t)1 << 32)
+#endif
+
+void mem_init(void);
+void mem_deinit(void);
+void *mem_sbrk(int incr);
+void mem_reset_brk(void);
+void *mem_heap_lo(void);
+void *mem_heap_hi(void);
+size_t mem_heapsize(void);
+size_t mem_pagesize(void);
@@ -0,0 +1,253 @@
+/*
+ * mkclasses.c - Build a size class table for mm.c's free lists from the
+ * request sizes in allocation traces.
+ *
+ * Every request of a size between the -m and -M limits (the sizes that
+ * reach the free lists past MIN_BLOCK, not the tree) counts toward a
+ * histogram. The classes are then chosen to minimize, over all those
+ * requests, how far the smallest block a fit search may return is above
+ * the request: a request of the size a class starts at may take any block
+ * of that class, and any other request has to skip to the next class.
+ * With k classes that puts class starts on the most requested sizes, and
+ * packs them closer where requests are dense.
+ *
+ * This is the classic optimal partition problem. For m classes, the best
+ * cost of the requests below each candidate start comes from the best
+ * m - 1 class cost at an earlier start, plus the cost of the class between
+ * them. The class cost is a Monge array, so the best earlier start never
+ * moves left as the later one moves right, and each level is solved by
+ * divide and conquer in O(n log n) over the n distinct sizes.
+ *
+ * The table is written as one request size per line, for mm_size_classes
+ * or mdriver -c, or with -H as a header for building mm.c with
+ * -DMM_CLASSES='"file.h"' (make CLASSES=file.h).
+ *
+ * Usage: mkclasses [-H] [-k classes] [-m min] [-M max] [-o out] trace...
+ *   -H	write a C header instead of a list
+ *   -k	classes to lay out, the first starting at 0 (default 144, as
+ *	many as the default layout has below 32768 bytes)
+ *   -m	requests of this many bytes or less are ignored (default 16)
+ *   -M	requests of this many bytes or more are ignored (default 32768)
+ *   -o	write to this file instead of stdout
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define MAXLINE		1024	/* Longest operation name */
+
+/* Function prototypes for internal helper routines */
+static int read_sizes(const char *file, unsigned long *hist, size_t min, size_t max);
+static long long class_cost(int i, int j);
+static void solve(long long *prev, long long *cur, int *arg, int lo, int hi, int optlo, int opthi);
+static void usage(const char *prog);
+
+/* The distinct sizes, v[1..n], with v[0] = 0 and v[n+1] the -M limit, and
+   prefix sums of their counts and of count * size */
+static size_t *v;
+static long long *csum, *ssum;
+
+int main(int argc, char **argv)
+{
+	size_t min = 16, max = 32768, i;
+	int k = 144, header = 0, n, m, b, j, best, c, t;
+	const char *out = NULL;
+	unsigned long *hist, requests = 0;
+	long long *prev, *cur, *tmp, cost;
+	int *arg, *start;
+	FILE *fp = stdout;
+
+	while ((c = getopt(argc, argv, "Hk:m:M:o:h")) != -1) {
+		switch (c) {
+		case 'H':
+			header = 1;
+			break;
+		case 'k':
+			if ((k = atoi(optarg)) < 1)
+				usage(argv[0]);
+			break;
+		case 'm':
+			min = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			max = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || max <= min + 1)
+		usage(argv[0]);
+
+	hist = calloc(max, sizeof(unsigned long));
+	for (t = optind; t < argc; t++)
+		if (read_sizes(argv[t], hist, min, max) < 0)
+			exit(1);
+
+	/* Distinct sizes and prefix sums, index 0 standing for size 0 */
+	v = malloc((max + 2) * sizeof(size_t));
+	csum = malloc((max + 2) * sizeof(long long));
+	ssum = malloc((max + 2) * sizeof(long long));
+	v[0] = 0;
+	csum[0] = ssum[0] = 0;
+	n = 0;
+	for (i = min + 1; i < max; i++) {
+		if (hist[i] == 0)
+			continue;
+		n++;
+		v[n] = i;
+		csum[n] = csum[n-1] + hist[i];
+		ssum[n] = ssum[n-1] + (long long)hist[i] * i;
+		requests += hist[i];
+	}
+	v[n+1] = max;
+	if (n == 0) {
+		fprintf(stderr, "No requests between %lu and %lu bytes\n",
+			(unsigned long)min, (unsigned long)max);
+		exit(1);
+	}
+
+	/* b class starts besides 0, each on a requested size */
+	b = k - 1 < n ? k - 1 : n;
+	prev = malloc((n + 1) * sizeof(long long));
+	cur = malloc((n + 1) * sizeof(long long));
+	arg = calloc((size_t)(b + 1) * (n + 1), sizeof(int));
+	start = malloc((b + 1) * sizeof(int));
+	cost = class_cost(0, n + 1);
+	best = 0;
+	if (b > 0) {
+		for (j = 1; j <= n; j++)
+			prev[j] = class_cost(0, j);
+		for (m = 2; m <= b; m++) {
+			solve(prev, cur, arg + (size_t)m * (n + 1), m, n, m - 1, n - 1);
+			tmp = prev;
+			prev = cur;
+			cur = tmp;
+		}
+		/* The last start, and the requests above it */
+		cost = LLONG_MAX;
+		for (j = b; j <= n; j++)
+			if (prev[j] + class_cost(j, n + 1) < cost) {
+				cost = prev[j] + class_cost(j, n + 1);
+				best = j;
+			}
+		for (m = b; m >= 1; m--) {
+			start[m] = best;
+			best = m > 1 ? arg[(size_t)m * (n + 1) + best] : 0;
+		}
+	}
+
+	if (out != NULL && (fp = fopen(out, "w")) == NULL) {
+		fprintf(stderr, "Could not open %s\n", out);
+		exit(1);
+	}
+	if (header) {
+		fprintf(fp, "/* Generated by mkclasses from");
+		for (t = optind; t < argc; t++)
+			fprintf(fp, " %s", argv[t]);
+		fprintf(fp, ":\n   %d classes for %lu requests of %d sizes, %.1f bytes mean excess */\n",
+			b + 1, requests, n, (double)cost / requests);
+		fprintf(fp, "static const size_t mm_class_bounds[] = {");
+		for (m = 1; m <= b; m++)
+			fprintf(fp, "%s%lu,", (m - 1) % 10 == 0 ? "\n\t" : " ", (unsigned long)v[start[m]]);
+		fprintf(fp, "\n};\n");
+	}
+	else {
+		fprintf(fp, "# mkclasses: %d classes for %lu requests of %d sizes, %.1f bytes mean excess\n",
+			b + 1, requests, n, (double)cost / requests);
+		for (m = 1; m <= b; m++)
+			fprintf(fp, "%lu\n", (unsigned long)v[start[m]]);
+	}
+	if (fp != stdout)
+		fclose(fp);
+	return 0;
+}
+
+/*
+ * read_sizes - Add the sizes of a trace's allocations and reallocations
+ * between min and max, exclusive, to hist. Returns -1, after saying why,
+ * if the trace cannot be read.
+ */
+static int read_sizes(const char *file, unsigned long *hist, size_t min, size_t max)
+{
+	FILE *fp;
+	char type[MAXLINE];
+	int heap_size, ids, ops, weight, index;
+	unsigned long size;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "Could not open %s\n", file);
+		return -1;
+	}
+	if (fscanf(fp, "%d %d %d %d", &heap_size, &ids, &ops, &weight) != 4) {
+		fprintf(stderr, "%s: bad trace header\n", file);
+		fclose(fp);
+		return -1;
+	}
+	while (fscanf(fp, "%1023s", type) == 1) {
+		if (type[0] == 'f') {
+			if (fscanf(fp, "%d", &index) != 1)
+				break;
+			continue;
+		}
+		if ((type[0] != 'a' && type[0] != 'r') || fscanf(fp, "%d %lu", &index, &size) != 2) {
+			fprintf(stderr, "%s: bad operation '%s'\n", file, type);
+			fclose(fp);
+			return -1;
+		}
+		if (size > min && size < max)
+			hist[size]++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * class_cost - The excess of the requests strictly between v[i] and v[j]
+ * when one class starts at v[i] and the next at v[j]: each has to take a
+ * block of at least v[j] bytes.
+ */
+static long long class_cost(int i, int j)
+{
+	if (j <= i + 1)
+		return 0;
+	return (long long)v[j] * (csum[j-1] - csum[i]) - (ssum[j-1] - ssum[i]);
+}
+
+/*
+ * solve - Fill cur[lo..hi] with the best cost below a class starting at
+ * v[j], given prev[] for one class fewer, knowing the best previous start
+ * lies in optlo..opthi. The start chosen goes in arg[j].
+ */
+static void solve(long long *prev, long long *cur, int *arg, int lo, int hi, int optlo, int opthi)
+{
+	int mid, i, best;
+	long long c;
+
+	if (lo > hi)
+		return;
+	mid = (lo + hi) / 2;
+	best = optlo;
+	cur[mid] = LLONG_MAX;
+	for (i = optlo; i <= opthi && i < mid; i++) {
+		c = prev[i] + class_cost(i, mid);
+		if (c < cur[mid]) {
+			cur[mid] = c;
+			best = i;
+		}
+	}
+	arg[mid] = best;
+	solve(prev, cur, arg, lo, mid - 1, optlo, best);
+	solve(prev, cur, arg, mid + 1, hi, best, opthi);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-H] [-k classes] [-m min] [-M max] [-o out] trace...\n", prog);
+	exit(1);
+}
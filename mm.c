@@ -3,21 +3,117 @@
  * lists, best fit placement, and boundary tag coalescing. 
  * Based from book code found here: http://csapp.cs.cmu.edu/public/code.html
  * 
- * An allocated block has a one word header and footer. Both of these contain
- * the size of the block and a bit to state whether allocated or free.
+ * An allocated block has a one word header only. It contains the size of
+ * the block, a bit to state whether allocated or free, and a bit to state
+ * whether the block before it is allocated.
  *
- * A free block contains the same header and footer as an allocated block,
+ * A free block contains the same header plus a footer holding its size,
  * and additionally has two one-word sized blocks containing pointers to the next
- * and previous blocks in that list. 
+ * and previous blocks in that list. Only free blocks need a footer, since
+ * coalesce only reads the footer of a previous block known to be free. 
  *
- * This free list is organized in reverse order of insertion. 
+ * Free blocks are indexed two-level segregated fit (TLSF) style: the first
+ * level splits sizes by power of two, the second level cuts each power of
+ * two into SL_COUNT equal ranges. A bitmap per level records which lists
+ * are non-empty, so finding a list that is certain to hold a fit is a
+ * couple of bit scans instead of a walk. Each list is organized in reverse
+ * order of insertion. 
+ *
+ * Which list a size maps to is looked up in class_of and class_fit, one
+ * entry per DSIZE below LARGE_BLOCK, built by mm_init. By default they
+ * follow the TLSF layout above. mm_size_classes, or a table generated by
+ * mkclasses from a workload's traces and compiled in with MM_CLASSES,
+ * replaces it with classes of any bounds, numbered through the lists in
+ * order, so the sizes a program asks for most get lists of their own.
+ *
+ * Free blocks of LARGE_BLOCK bytes and up always follow the TLSF layout,
+ * in the lists from LARGE_LIST on, whatever classes the smaller sizes use.
+ *
+ * Small blocks freed by a thread are first kept in that thread's cache
+ * (tcache), binned by exact block size. They stay marked allocated while
+ * cached, so they never coalesce, and mm_malloc hands them straight back
+ * out. Bins that overflow are flushed into the free lists in batches.
+ * The bins are mm_cache, declared in mm.h, so that mm_malloc of a size
+ * known at compile time can pop its bin inline in the caller and only
+ * come here when the bin is empty.
+ *
+ * With M_DEFER_COALESCE set, blocks of up to QUICK_MAX_SIZE bytes freed to
+ * an arena do not coalesce either. They too stay marked allocated and go
+ * on a per-size quick list of the arena, from which mm_malloc takes exact
+ * fits. Once more than the set number of blocks are waiting, or a search
+ * of the free lists comes up empty, all of them are coalesced in one pass.
+ *
+ * Requests of mmap_threshold bytes and up get a mapping of their own. The
+ * block header carries the MMAPPED bit and the mapping length sits just
+ * before it, so mm_free can munmap it at once and mm_realloc can mremap it.
+ *
+ * Free memory is given back by mm_trim: a large free block at the end of
+ * the heap is cut back with a negative mem_sbrk, and the whole pages inside
+ * large free blocks are released with madvise(MADV_DONTNEED). mm_free runs
+ * it by itself every trim_threshold bytes freed.
+ *
+ * A free block whose ZEROED bit is set holds nothing but zeros apart from
+ * its header, footer and the four words after the header (the links and
+ * two more). Purged blocks are such blocks, and so is fresh heap if mem_sbrk
+ * hands out zeroed memory. Splits pass the bit on and merges keep it by
+ * clearing the seam, so mm_calloc only has to clear a few words.
+ *
+ * The heap grows by grow_size bytes at a time. grow_size doubles, up to
+ * grow_max, when the heap had to grow again after only a few allocations,
+ * and halves back toward grow_min when growth has become rare.
+ *
+ * All of the above except the thread cache lives in an arena, and there
+ * is one arena per CPU, each with its own lock. A thread uses the arena
+ * it last used while that is free, and moves to the arena of the CPU it
+ * is on when it finds it busy. Arenas share the one mem_sbrk heap: each
+ * owns a chain of segments, every segment with its own prologue and
+ * epilogue so coalescing never crosses into another arena. The heap is
+ * handed out in ARENA_GRAIN units, and arena_map records which arena
+ * owns each grain, so mm_free can find the arena of any block.
+ *
+ * A thread freeing a block that belongs to another thread's arena does
+ * not take that arena's lock. It pushes the block, still marked
+ * allocated, on the arena's remote free stack with a compare-and-swap,
+ * and the next thread to lock the arena frees the whole stack at once.
+ *
+ * mm_stats reports what the allocator has done and holds. Its counters
+ * live in each thread's tcache, cost an increment or two per call, and
+ * are summed only when read; building with MM_STATS=0 removes them. The
+ * free list and fragmentation figures are worked out on the spot by
+ * walking the lists.
+ *
+ * The heap profiler, off until M_PROFILE_RATE is set, samples blocks the
+ * way tcmalloc does: each thread counts down the bytes it allocates and
+ * samples the block that takes the count below zero, then draws the next
+ * count from an exponential distribution. A sampled block's backtrace is
+ * kept until it is freed, and mm_profile_dump writes the live and total
+ * samples per call stack as a pprof-readable heap profile.
+ *
+ * mm_check verifies the whole heap in linear time: one walk over the
+ * blocks marks every free block in a bitmap, and one pass over the lists
+ * must find each marked block exactly once. mm_check_step does
+ * the same checks a slice at a time under the arena lock, testing each
+ * free block's list links instead of the bitmap, so it can run alongside
+ * a live workload.
  * 
  */
  
+#define _GNU_SOURCE	/* mremap, sched_getcpu */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-
+#include <stddef.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <stdarg.h>
+
+#define MM_NO_FAST_PATH	/* mm_malloc here is the function itself */
 #include "mm.h"
 #include "memlib.h"
 
@@ -36,45 +132,107 @@ team_t team = {
 
 /* Macros based on book code mm.c */
 
+/* 
+ * Heap layout. The default compact layout uses 4-byte words on both 32 and
+ * 64-bit builds: headers and footers are 4 bytes, and free list links are
+ * 4-byte offsets from the start of the heap counted in doublewords, so a
+ * free block needs only 16 bytes and the heap can grow to 32 GB. A single
+ * block is capped at MAX_BLOCK (just under 4 GB).
+ *
+ * Build with -DWIDE_HEAP=1 for 8-byte words and 16-byte alignment: headers
+ * and links are full 64-bit values, so neither the heap nor a block has a
+ * size limit, at the cost of 4 more bytes per allocated block and a
+ * 32-byte minimum block.
+ */
+#ifndef WIDE_HEAP
+#define WIDE_HEAP	0
+#endif
+
 /* Basic constants and macros */
+#if WIDE_HEAP
+typedef unsigned long word_t;	/* Header, footer and link word */
+#define WSIZE       8       /* Word and header/footer size (bytes) */
+#define DSIZE       16      /* Doubleword size (bytes) */
+#define ALIGN_LOG2	4	/* log2(DSIZE) */
+#define MAX_BLOCK	(((word_t)1 << 62) - DSIZE)	/* Largest block size */
+#else
+typedef unsigned int word_t;	/* Header, footer and link word */
 #define WSIZE       4       /* Word and header/footer size (bytes) */
 #define DSIZE       8       /* Doubleword size (bytes) */
+#define ALIGN_LOG2	3	/* log2(DSIZE) */
+#define MAX_BLOCK	((word_t)-DSIZE)	/* Largest size a header can hold */
+#endif
 #define CHUNKSIZE  (1<<12)/4  /* Extend heap by this amount (bytes) */
 //#define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
+/* Header bit: the block just before this one is allocated */
+#define PREV_ALLOC	0x2
+/* Header bit: the block is a mapping of its own, not part of the heap */
+#define MMAPPED		0x4
+/* The same bit on a free block: all but its header, links and footer
+   is zero, because it was purged or is fresh from mem_sbrk */
+#define ZEROED		0x4
+
 /* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+#define GET(p)       (*(word_t *)(p))
+#define PUT(p, val)  (*(word_t *)(p) = (val))
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_SIZE(p)  (GET(p) & ~(word_t)0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MMAPPED(p) (GET(p) & MMAPPED)
+
+/* The header of an allocated block, read by the thread that owns the
+   block without the arena lock. Neighbours set and clear its PREV_ALLOC
+   bit under the lock, so that read and those writes are relaxed atomics */
+#define GET_OWN(bp)	__atomic_load_n((word_t *)HDRP(bp), __ATOMIC_RELAXED)
+
+/* Set or clear the prev-allocated bit in the header of block bp. Every
+   writer holds the arena lock, so a load and a store will do */
+#define SET_PREV_ALLOC(bp)	__atomic_store_n((word_t *)HDRP(bp), \
+	GET(HDRP(bp)) | PREV_ALLOC, __ATOMIC_RELAXED)
+#define CLR_PREV_ALLOC(bp)	__atomic_store_n((word_t *)HDRP(bp), \
+	GET(HDRP(bp)) & ~(word_t)PREV_ALLOC, __ATOMIC_RELAXED)
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((void *)(bp) - WSIZE)
 #define FTRP(bp)       ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks.
+   PREV_BLKP reads the previous footer, so only use it if that block is free */
 #define NEXT_BLKP(bp)  ((void *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((void *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Convert between a free block pointer and the link word stored for it */
+#if WIDE_HEAP
+#define PTR_TO_LINK(bp)	((word_t)(bp))
+#define LINK_TO_PTR(w)	((void *)(w))
+#else
+#define PTR_TO_LINK(bp)	((bp) == NULL ? 0 : (word_t)(((char *)(bp) - heap_base) / DSIZE))
+#define LINK_TO_PTR(w)	((w) == 0 ? NULL : (void *)(heap_base + (size_t)(w) * DSIZE))
+#endif
+
 /*  macros for free block pointers */
 #define NEXT_FREE(bp)	((char *)(bp))
 #define PREV_FREE(bp) 	((char *)(bp) + WSIZE)
 
 /* Set and retrieve free pointers */
-#define SET(p, val)		(*(unsigned int *)(p) = (val))
-#define GET_PTR(p)		(void *)(p)
+#define SET(p, ptr)		PUT(p, PTR_TO_LINK(ptr))
+#define GET_PTR(p)		LINK_TO_PTR(GET(p))
 
 /*SOME MORE MACROS*/
-#define BP_TO_SIZE(bp) (((unsigned int *)bp)[-1])
-#define BP_TO_NEXT_FREE(bp) (((void**)bp)[0])
-#define BP_TO_PREV_FREE(bp) (((void**)bp)[1])
+#define BP_TO_SIZE(bp) (((word_t *)bp)[-1])
+#define BP_TO_NEXT_FREE(bp) GET_PTR(NEXT_FREE(bp))
+#define BP_TO_PREV_FREE(bp) GET_PTR(PREV_FREE(bp))
+#define SET_NEXT_FREE(bp, ptr) SET(NEXT_FREE(bp), ptr)
+#define SET_PREV_FREE(bp, ptr) SET(PREV_FREE(bp), ptr)
 
 /* DEBUG: 1 if true, 0 if false. Will say more things if true.*/
 #define DEBUG	0
@@ -82,14 +240,114 @@ team_t team = {
 #define	CHEAP() {if(DEBUG)mm_check(0);fflush(stdout);}
 #define	PLIST() {if(DEBUG)printlists();;fflush(stdout);}
 
-#define LIST_0_SIZE (unsigned int)(32)
-#define LIST_1_SIZE (unsigned int)(64)
-#define LIST_2_SIZE (unsigned int)(128)
-#define LIST_3_SIZE (unsigned int)(512)
-#define LIST_4_SIZE (unsigned int)(4096)
-#define LIST_5_SIZE (unsigned int)(16384)
-#define LIST_6_SIZE (unsigned int)(32768)
-#define LIST_7_SIZE (unsigned int)(131072)
+/* Two-level segregated fit index */
+#define SL_LOG2		4	/* Second level lists per power of two, log2 */
+#define SL_COUNT	(1 << SL_LOG2)
+#define FL_SHIFT	(SL_LOG2 + ALIGN_LOG2)
+#define SMALL_BLOCK	(1 << FL_SHIFT)	/* Below this the lists are DSIZE apart */
+#define FL_MAX		32	/* Block sizes fit in a header word */
+#define FL_COUNT	(FL_MAX - FL_SHIFT + 1)
+
+/* Free blocks this big are kept in TLSF lists whatever the class layout */
+#define LARGE_LOG2	15
+#define LARGE_BLOCK	(unsigned int)(1 << LARGE_LOG2)
+
+/* Size class tables: one entry per DSIZE of block size below LARGE_BLOCK,
+   holding a list number fl * SL_COUNT + sl */
+#define CLASS_SLOTS	(LARGE_BLOCK / DSIZE)
+#define LIST_COUNT	(FL_COUNT * SL_COUNT)
+/* First list of the blocks from LARGE_BLOCK up; classes end before it */
+#define LARGE_LIST	((LARGE_LOG2 - FL_SHIFT + 1) << SL_LOG2)
+
+/* Blocks of its own list a fit search walks when no list above can serve */
+#define FIT_SCAN	MM_FIT_SCAN
+
+#ifdef MM_CLASSES
+/* Generated by mkclasses -H: the request sizes the classes start at,
+   in mm_class_bounds[] */
+#include MM_CLASSES
+#endif
+
+/* Smallest block: a free block must hold both links and a footer */
+#define MIN_BLOCK	(4*WSIZE)
+
+/* Default for M_MMAP_THRESHOLD */
+#define MMAP_THRESHOLD	(size_t)(131072)
+
+/* Bytes before bp in a mapped block: the mapping length, then the header */
+#define MMAP_HDR	(DSIZE * ((sizeof(size_t) + WSIZE + (DSIZE-1)) / DSIZE))
+#define MMAP_LEN(bp)	(*(size_t *)((char *)(bp) - MMAP_HDR))
+/* Start of the mapping, which MMAP_LEN counts from. It is bp - MMAP_HDR
+   unless the block was aligned further into its first page */
+#define MMAP_BASE(bp)	((char *)(((unsigned long)(bp) - MMAP_HDR) & ~(unsigned long)(mem_pagesize()-1)))
+
+/* Default for M_GROW_MAX */
+#define GROW_MAX	(size_t)(1<<18)
+
+/* Growth speeds up if the heap grows again within GROW_BURST heap
+   allocations, and slows down if it took more than GROW_IDLE */
+#define GROW_BURST	64
+#define GROW_IDLE	4096
+
+/* Defaults for M_TRIM_THRESHOLD and M_TOP_PAD */
+#define TRIM_THRESHOLD	(size_t)(1<<20)
+#define TOP_PAD		(size_t)(1<<16)
+
+/* Set to 1 if mem_sbrk accepts a negative increment to shrink the heap;
+   otherwise the end of the heap is purged with madvise instead */
+#ifndef MEM_SBRK_SHRINKS
+#define MEM_SBRK_SHRINKS	0
+#endif
+
+/* Set to 1 to have mm_free_sized check the caller's size against the
+   header, at the cost of the header read it is meant to save */
+#ifndef SIZED_FREE_CHECK
+#define SIZED_FREE_CHECK	0
+#endif
+
+/* Set to 1 if mem_sbrk always returns zeroed memory, as fresh anonymous
+   pages are; new heap is then known to be zero */
+#ifndef SBRK_ZEROED
+#define SBRK_ZEROED	0
+#endif
+
+/* Set to 0 to compile out the counters behind mm_stats */
+#ifndef MM_STATS
+#define MM_STATS	1
+#endif
+
+/* Set to 0 to compile out the heap profiler */
+#ifndef MM_PROFILE
+#define MM_PROFILE	1
+#endif
+
+/* Largest single mem_sbrk call; bigger extensions are made in pieces */
+#define SBRK_STEP	((size_t)1 << 30)
+
+/* Most bytes the heap may span. Compact links reach 32 GB; wide ones
+   could reach anything, but arena_map has to cover it */
+#if WIDE_HEAP
+#define HEAP_SPAN	((size_t)1 << 40)
+#else
+#define HEAP_SPAN	((size_t)0xffffffff * DSIZE)
+#endif
+
+/* One bit per doubleword of heap, set by mm_check for each free block */
+#define MAP_BIT(bp)	((size_t)((char *)(bp) - heap_base) / DSIZE)
+#define MAP_TEST(map, bp)	((map)[MAP_BIT(bp) >> 3] & (1 << (MAP_BIT(bp) & 7)))
+#define MAP_SET(map, bp)	((map)[MAP_BIT(bp) >> 3] |= 1 << (MAP_BIT(bp) & 7))
+#define MAP_CLR(map, bp)	((map)[MAP_BIT(bp) >> 3] &= ~(1 << (MAP_BIT(bp) & 7)))
+/* p could be a block in the heap: a bit of the map belongs to it */
+#define IN_HEAP(p)	((char *)(p) > heap_base && \
+	(char *)(p) < heap_base + mem_heapsize() && (size_t)(p) % DSIZE == 0)
+
+/* A block that mm_check_step would resume at is merging into another */
+#define CHECK_MERGE(ar, gone, into)	{if ((ar)->check_at == (void *)(gone)) (ar)->check_at = (into);}
+
+/* Arenas, and the unit of heap they are handed */
+#define MAX_ARENAS	64
+#define ARENA_GRAIN_LOG2	12
+#define ARENA_GRAIN	((size_t)1 << ARENA_GRAIN_LOG2)
 
 /* Epic macros for SAY */
 #define SAY(fmt)		SAY0(fmt)
@@ -119,34 +377,339 @@ void doAssert(int c)
 
 
 /* Global variables */
-static char *heap_listp = 0;  /* Pointer to first block */
-static char *heap_lastp = 0; /* pointer to last free block */
-static void **lists;		/* Point to first free list item */
-static void* free_lastp;	/* Point to last free list item*/
+static char *heap_base = 0;	/* mem_heap_lo(), origin of compact links */
+static size_t mmap_threshold = MMAP_THRESHOLD;	/* Smallest request given a mapping */
+static long trim_threshold = TRIM_THRESHOLD;	/* Bytes freed between trims, <0 never */
+static size_t top_pad = TOP_PAD;	/* Free bytes left at the heap end by a trim */
+static size_t grow_min = CHUNKSIZE;	/* Smallest heap extension */
+static size_t grow_max = GROW_MAX;	/* Largest heap extension */
+static int prefault;		/* Touch new heap pages as they are added */
+unsigned int mm_heap_gen;	/* Bumped by mm_init; stale tcaches are dropped */
+static size_t mmap_bytes;	/* Bytes mapped for blocks of their own */
+
+/* List a free block of each size is kept in, and the first list whose
+   blocks all hold a block of that size */
+static unsigned short class_of[CLASS_SLOTS];
+static unsigned short class_fit[CLASS_SLOTS];
+/* Block sizes the classes start at, for the next mm_init */
+static unsigned int class_lo[LIST_COUNT];
+static int class_count = -1;	/* Classes in class_lo, 0 for TLSF, -1 not set yet */
+
+/* Per-thread cache of recently freed small blocks */
+#define TCACHE_MAX_SIZE	(unsigned int)(MM_CACHE_MAX)	/* Largest block size cached */
+#define TCACHE_BINS	MM_CACHE_BINS	/* One bin per block size */
+#define TCACHE_FILL	32	/* Most blocks a bin may hold */
+#define TCACHE_FLUSH	(TCACHE_FILL/2)	/* Blocks sent back to lists[] on overflow */
+
+/* The bins live in mm_cache, declared in mm.h for its inline fast path,
+   and are linked through a plain pointer so it can follow them */
+#define TC_NEXT(bp)	(*(void **)(bp))
+
+#if MM_WSIZE != WSIZE
+#error "mm.h and mm.c disagree on WIDE_HEAP"
+#endif
 
-/* Function prototypes for internal helper routines */
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize, int index);
-static void *coalesce(void *bp);
-static void printblock(void *bp); 
-static void checkblock(void *bp);
+/* One thread's share of the mm_stats counters */
+struct thread_stats {
+	unsigned long mallocs[MM_STATS_CLASSES];	/* Blocks handed out, by block size */
+	unsigned long frees[MM_STATS_CLASSES];	/* Blocks given back, by block size */
+	unsigned long tcache_hits;	/* Allocations served from the cache */
+	unsigned long tcache_misses;	/* Cacheable allocations that were not */
+	unsigned long realloc_inplace;	/* mm_realloc calls that kept the block */
+	unsigned long realloc_copies;	/* mm_realloc calls that copied */
+	unsigned long realloc_copied;	/* Payload bytes mm_realloc copied or slid down */
+	unsigned long realloc_saved;	/* Payload bytes it kept where they were */
+	unsigned long extends;		/* extend_heap calls */
+	unsigned long fits;		/* Free list searches that found a block */
+	unsigned long fit_exact;	/* Of those, found in the list of their own size */
+	unsigned long fit_excess;	/* Bytes the blocks found were over the size */
+	unsigned long fit_scans[FIT_SCAN + 1];	/* Own list walks, by blocks looked at */
+	long live;		/* Block bytes handed out less those given back */
+};
+
+/* The rest of a thread's allocator state */
+struct tcache {
+	struct mm_cache *cache;	/* This thread's mm_cache */
+	int armed;		/* Exit destructor registered for this thread */
+#if MM_STATS
+	int listed;		/* On stats_threads */
+	struct tcache *next_listed;	/* Next thread on stats_threads */
+	struct thread_stats stats;
+	long live_pending;	/* Change in live not yet added to live_total */
+	unsigned long fast_flushed;	/* cache->fast_bytes already in live_pending */
+#endif
+};
+
+#if MM_PROFILE
+__thread struct mm_cache mm_cache;
+#else
+/* Nothing ever samples; keep the fast path from stopping to ask */
+__thread struct mm_cache mm_cache = { .countdown = LONG_MAX };
+#endif
+static __thread struct tcache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+#if MM_STATS
+static struct tcache *stats_threads;	/* Every thread with counters */
+static struct thread_stats stats_dead;	/* Counters of threads that have exited */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;	/* All of the above */
+static long live_total;		/* Live bytes, give or take LIVE_FLUSH a thread */
+static size_t peak_live;	/* Highest live_total seen */
+static size_t peak_footprint;	/* Highest mm_footprint seen by stats_peak */
+
+/* A thread adds its change in live bytes to live_total once it is this big */
+#define LIVE_FLUSH	(64*1024)
+
+/* Size class of a block: floor(log2(bytes)) */
+#define STAT_CLASS(bytes)	(63 - __builtin_clzl((unsigned long)(bytes) | 1))
+/* The calling thread's counters */
+#define STATS()		(tcache.listed ? &tcache.stats : stats_register())
+/* Only the owner writes a counter, but mm_stats reads it from any thread */
+#define STAT_LOAD(s, field)	__atomic_load_n(&(s)->field, __ATOMIC_RELAXED)
+#define STAT_BUMP(s, field, n)	__atomic_store_n(&(s)->field, (s)->field + (n), __ATOMIC_RELAXED)
+#define STAT_INC(field)	STAT_ADD(field, 1)
+#define STAT_ADD(field, n)	do { struct thread_stats *s_ = STATS(); \
+	STAT_BUMP(s_, field, n); } while (0)
+#define STAT_PEAK()	stats_peak()
+#else
+#define STAT_INC(field)
+#define STAT_ADD(field, n)
+#define STAT_PEAK()
+#endif
+
+#if MM_PROFILE
+#define PROF_DEPTH	32	/* Most frames kept of a sampled call stack */
+#define PROF_BUCKETS	4096	/* Hash buckets for samples, and for stacks */
+#define PROF_FILTER	65536	/* Counters behind the "might be sampled" test */
+#define PROF_CHUNK	(1 << 16)	/* Bytes mapped at a time for profile records */
+#define PROF_IDLE	((long)1 << 20)	/* Bytes between looks at prof_rate while off */
+
+/* A call stack that allocated sampled blocks */
+struct prof_stack {
+	struct prof_stack *next;	/* Next stack in the hash bucket */
+	unsigned long hash;
+	int depth;
+	void *pc[PROF_DEPTH];
+	unsigned long live_count;	/* Sampled blocks not yet freed */
+	size_t live_bytes;
+	unsigned long total_count;	/* Every block sampled here */
+	size_t total_bytes;
+};
+
+/* A sampled block that has not been freed */
+struct prof_sample {
+	struct prof_sample *next;	/* Next in the hash bucket or on prof_spare */
+	void *bp;
+	size_t bytes;
+	struct prof_stack *stack;
+};
+
+static long prof_rate;		/* Mean bytes between samples, 0 off */
+static unsigned int prof_gen;	/* Bumped whenever prof_rate is set */
+static int prof_signo;		/* Signal that asks for a dump, 0 none */
+static volatile sig_atomic_t prof_pending;	/* That signal has arrived */
+static unsigned int prof_dumps;	/* Dumps written under generated names */
+static struct prof_stack *prof_stacks[PROF_BUCKETS];
+static struct prof_sample *prof_samples[PROF_BUCKETS];
+static struct prof_sample *prof_spare;	/* Sample records to reuse */
+static char *prof_pool, *prof_pool_end;	/* Unused part of the record mapping */
+static unsigned short prof_filter[PROF_FILTER];	/* Live samples per filter slot */
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;	/* All of the above bar prof_rate */
+
+static __thread long prof_thread_rate;	/* prof_rate the countdown was drawn for */
+static __thread unsigned int prof_thread_gen;	/* prof_gen it was drawn at */
+static __thread unsigned long prof_seed;	/* xorshift state for the draws */
+static __thread int prof_busy;	/* Inside prof_sample; allocations are not sampled */
+
+/* Spread an address over a word; the top bits index the tables */
+#define PROF_HASH(bp)	(((unsigned long)(bp) >> ALIGN_LOG2) * 0x9e3779b97f4a7c15UL)
+#define PROF_SLOT(bp)	(PROF_HASH(bp) >> (64 - 16))	/* Index into prof_filter */
+#define PROF_BUCKET(bp)	(PROF_HASH(bp) >> (64 - 12))	/* Index into prof_samples */
+#endif
+
+#if MM_STATS || MM_PROFILE
+#define NOTE_ALLOC(bp, bytes)	note_alloc(bp, bytes)
+#define NOTE_FREE(bp)	note_free(bp, block_bytes(bp))
+#define NOTE_RESIZE(old, oldbytes, bp, bytes)	note_resize(old, oldbytes, bp, bytes)
+#else
+#define NOTE_ALLOC(bp, bytes)
+#define NOTE_FREE(bp)
+#define NOTE_RESIZE(old, oldbytes, bp, bytes)
+#endif
 
-/* TODO: Functions we want to make */
+/* Per-arena quick lists of blocks whose coalescing is put off */
+#define QUICK_MAX_SIZE	(unsigned int)(2048)	/* Largest block size deferred */
+#define QUICK_BINS	(QUICK_MAX_SIZE/DSIZE + 1)	/* One list per block size */
+
+static int defer_limit;		/* Blocks waiting per arena before a consolidation, 0 none */
+
+/* An independent heap: its own segments and free lists */
+struct arena {
+	pthread_mutex_t lock;	/* Held for any change to the fields below */
+	unsigned char id;	/* Index + 1, as stored in arena_map */
+	char *heap_listp;	/* Prologue of the first segment */
+	char *last_seg;		/* Prologue of the newest segment */
+	char *heap_end;		/* Just past the newest segment's epilogue */
+	void *lists[FL_COUNT][SL_COUNT];	/* First block of each free list */
+	unsigned int fl_bitmap;		/* Bit f set if any lists[f][] is non-empty */
+	unsigned int sl_bitmap[FL_COUNT];	/* Bit s set if lists[f][s] is non-empty */
+	size_t freed_since_trim;	/* Bytes freed since the last trim */
+	unsigned int dirty_large;	/* At least the large listed blocks not ZEROED */
+	size_t grow_size;	/* Current heap extension */
+	unsigned long allocs_since_grow;	/* Heap allocations since extend_heap */
+	void *quick[QUICK_BINS];	/* Freed blocks not yet coalesced, by size */
+	unsigned int quick_count;	/* Blocks on all quick lists */
+	void *check_at;		/* Block mm_check_step resumes at, NULL between passes */
+	char *check_seg;	/* Segment check_at is in */
+	/* Blocks freed by other threads, linked through their first word.
+	   Pushed to without the lock, so kept off the locked fields' lines */
+	void *remote_frees __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+static struct arena arenas[MAX_ARENAS];
+static int narenas;		/* Arenas threads are spread over */
+static unsigned int arena_next;	/* Round-robin pick when the CPU is unknown */
+static __thread struct arena *thread_arena;	/* Arena this thread last used */
+static unsigned char *arena_map;	/* Owning arena id of each heap grain, 0 if none */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;	/* mem_sbrk, arena_map */
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
 
-void mm_check(int verbose);
+/* Function prototypes for internal helper routines */
+static void *extend_heap(struct arena *ar, size_t words);
+static void *heap_sbrk(size_t size);
+/* Pick the size of the next heap extension */
+static size_t grow_heap_size(struct arena *ar);
+static void place(struct arena *ar, void *bp, size_t asize);
+static void *find_fit(struct arena *ar, size_t asize);
+/* find_fit without the consolidation on a miss */
+static void *search_fit(struct arena *ar, size_t asize);
+/* Best fit among the first FIT_SCAN blocks of one list, or NULL */
+static void *scan_list(struct arena *ar, int fl, int sl, size_t asize);
+static void *coalesce(struct arena *ar, void *bp);
+static void printblock(void *bp); 
+/* Check a block against its neighbours, return the problems found or -1
+   if the walk cannot go past it */
+static int checkblock(struct arena *ar, void *bp);
+
+/* Check one arena's segments and lists, return the problems found */
+static int arena_check(struct arena *ar, unsigned char *map, int verbose);
+/* Check that a free block's list neighbours point back at it */
+static int check_links(struct arena *ar, void *bp);
+/* Check the list heads, bitmaps and quick list heads */
+static int check_heads(struct arena *ar);
+/* Return 1 if p points at a free heap block of the arena */
+static int is_free_block(struct arena *ar, void *p);
 /* Add to list, return 1 if success and 0 if fail */
-static int list_add(void* bp); 
+static int list_add(struct arena *ar, void* bp); 
 /* Delete to list, return 1 if success and 0 if fail */
-static int list_rm(void* bp);
+static int list_rm(struct arena *ar, void* bp);
 /* Print a single list */
-static void printlist(int index);
+static void printlist(struct arena *ar, int fl, int sl);
 /* Driver to print all lists*/
 static void printlists();
-/* Check if block is in the list */
-static int list_search(void* bp);
-/* Return the appropriate list index for a given size */
-static int get_index(size_t size);
+/* Return the list a block of this size is kept in */
+static void get_index(size_t size, int *fl, int *sl);
+/* The default TLSF layout: the list number of a block size */
+static int tlsf_index(size_t size);
+/* Fill class_of and class_fit from class_lo, or with the TLSF layout */
+static void classes_init(void);
+/* Return the first list whose blocks are all at least this size */
+static void get_fit_index(size_t size, int *fl, int *sl);
+/* Take a cached block of exactly asize bytes, or NULL */
+static void *tcache_get(size_t asize);
+/* Cache a block being freed, return 1 if cached and 0 if not */
+static int tcache_put(void *bp, size_t size);
+/* Return the oldest n blocks of a bin to the free lists */
+static void tcache_flush(struct mm_cache_bin *bin, unsigned int n);
+/* Create the key whose destructor drains a thread's cache on exit */
+static void tcache_key_init(void);
+/* Thread exit destructor: flush every bin */
+static void tcache_exit(void *arg);
+/* Give a request a mapping of its own, or NULL */
+static void *mmap_alloc(size_t size, size_t align);
+/* Unmap a block that has a mapping of its own */
+static void mmap_free(void *bp);
+/* Resize a mapped block with mremap, or NULL */
+static void *mmap_realloc(void *bp, size_t size);
+/* Release the whole pages inside a free block, return the bytes released */
+static size_t purge_block(void *bp);
+/* Purge every large free block of an arena, return the bytes */
+static size_t purge_large(struct arena *ar);
+/* Size the arena set and create the locks, once */
+static void arena_setup(void);
+/* Forget an arena's heap, as mm_init does */
+static void arena_reset(struct arena *ar);
+/* Lock and return the arena the calling thread should use */
+static struct arena *arena_lock(void);
+/* Return the arena owning a heap block, or NULL if not in the heap */
+static struct arena *arena_of(void *bp);
+/* Grow an arena's heap by size bytes, return the new block or NULL */
+static void *arena_sbrk(struct arena *ar, size_t size);
+/* Record id as the owner of every grain in [lo, hi) */
+static void arena_mark(char *lo, char *hi, unsigned char id);
+/* Trim one arena, return 1 if anything was released */
+static int arena_trim(struct arena *ar, size_t pad);
+/* Shrink the heap under the arena's last block, return 1 if done */
+static int arena_shrink(struct arena *ar, void *bp, size_t release);
+/* Mark an allocated heap block free and coalesce it */
+static void free_block(struct arena *ar, void *bp);
+/* Mark an allocated block free and coalesce it now */
+static void merge_block(struct arena *ar, void *bp);
+/* Pop a deferred block of exactly asize bytes */
+static void *quick_get(struct arena *ar, size_t asize);
+/* Coalesce every block on the arena's quick lists */
+static void quick_consolidate(struct arena *ar);
+/* Push a block freed by a foreign thread on its arena's remote stack */
+static void remote_free(struct arena *ar, void *bp);
+/* Free every block on the remote stack of a locked arena */
+static void remote_drain(struct arena *ar);
+/* Clear the metadata words of lo and hi that end up inside their merger */
+static void zero_seam(void *lo, void *hi);
+#if MM_STATS || MM_PROFILE
+/* Bytes a block takes up, whichever kind it is */
+static size_t block_bytes(void *bp);
+#endif
+#if MM_STATS
+/* Put the calling thread's counters on stats_threads */
+static struct thread_stats *stats_register(void);
+/* Fold an exiting thread's counters into stats_dead */
+static void stats_unregister(struct tcache *tc);
+/* Add every thread's counters into one */
+static void stats_sum(struct thread_stats *sum);
+/* Add one thread's counters to sum; stats_lock held */
+static void stats_add(struct thread_stats *sum, struct tcache *tc);
+/* Add bytes to this thread's change in live bytes */
+static void stats_live(long bytes);
+/* Raise peak to at least value */
+static void stats_max(size_t *peak, size_t value);
+/* Bring peak_footprint up to date */
+static void stats_peak(void);
+#endif
+#if MM_STATS || MM_PROFILE
+/* Count a block handed out, given back or resized in place */
+static void note_alloc(void *bp, size_t bytes);
+static void note_free(void *bp, size_t bytes);
+static void note_resize(void *old, size_t oldbytes, void *bp, size_t bytes);
+#endif
+#if MM_PROFILE
+/* Sample a block, and draw the bytes to allocate before the next one */
+static void prof_sample(void *bp, size_t bytes);
+/* Forget a sampled block that is being freed */
+static void prof_free(void *bp);
+/* Follow a sampled block resized in place, maybe to a new address */
+static void prof_move(void *old, void *bp, size_t bytes);
+/* Unlink the sample of bp from its bucket; prof_lock held */
+static struct prof_sample *prof_unlink(void *bp);
+/* Space for profile records; prof_lock held */
+static void *prof_record(size_t size);
+/* Bytes to allocate before the next sample */
+static long prof_next(long rate);
+/* Signal handler that asks for a dump */
+static void prof_signal(int signo);
+#endif
+/* qsort comparison of two block pointers by address */
+static int ptr_cmp(const void *a, const void *b);
 
 /* 
  * mm_init - Initialize the memory manager, setting up lists and getting 
@@ -155,37 +718,81 @@ static int get_index(size_t size);
  */
 int mm_init(void) 
 {
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(14*WSIZE)) == (void *)-1)
-		return -1;
+	int i;
+
+	pthread_once(&arena_once, arena_setup);
+	heap_base = mem_heap_lo();
+
+	/* One owner byte per grain the heap could ever span */
+	if (arena_map == NULL) {
+		arena_map = mmap(NULL, (HEAP_SPAN >> ARENA_GRAIN_LOG2) + 1, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (arena_map == MAP_FAILED) {
+			arena_map = NULL;
+			return -1;
+		}
+	}
+	else
+		madvise(arena_map, (HEAP_SPAN >> ARENA_GRAIN_LOG2) + 1, MADV_DONTNEED);
 		
-	SAY("\ndid initial sbrk\n");
-	heap_lastp = heap_listp;
-	free_lastp = NULL;
-    heap_listp += (2*WSIZE);
-	lists = (void*) heap_listp;
-	lists[0] = NULL;
-	SAY("\ndid some initial settings\n");
-	lists[1] = NULL;
-	lists[2] = NULL;
-	lists[3] = NULL;
-	lists[4] = NULL;
-	lists[5] = NULL;
-	lists[6] = NULL;
-	lists[7] = NULL;
-	SAY1("\ndid initial lists[i] settings. lists[1] is: [%p]\n", lists[1]);
-    heap_listp += (8*WSIZE);
-
-    PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
-    heap_listp += (2*WSIZE);
+	mm_heap_gen++;
+	memset(mm_cache.bins, 0, sizeof(mm_cache.bins));
+	mm_cache.gen = mm_heap_gen;
+	pthread_once(&tcache_once, tcache_key_init);
+#if MM_STATS
+	/* A new heap starts its statistics from zero */
+	{
+		struct tcache *tc;
+
+		pthread_mutex_lock(&stats_lock);
+		for (tc = stats_threads; tc != NULL; tc = tc->next_listed) {
+			memset(&tc->stats, 0, sizeof(tc->stats));
+			for (i = 0; i < TCACHE_BINS; i++)
+				tc->cache->bins[i].fast_hits = 0;
+			tc->cache->fast_bytes = 0;
+			tc->live_pending = 0;
+			tc->fast_flushed = 0;
+		}
+		memset(&stats_dead, 0, sizeof(stats_dead));
+		live_total = 0;
+		peak_live = peak_footprint = 0;
+		pthread_mutex_unlock(&stats_lock);
+	}
+#endif
+#if MM_PROFILE
+	/* Samples of the old heap are gone; the totals of their stacks stay */
+	{
+		struct prof_sample *ps;
+		struct prof_stack *pst;
+
+		pthread_mutex_lock(&prof_lock);
+		for (i = 0; i < PROF_BUCKETS; i++) {
+			while ((ps = prof_samples[i]) != NULL) {
+				prof_samples[i] = ps->next;
+				ps->next = prof_spare;
+				prof_spare = ps;
+			}
+			for (pst = prof_stacks[i]; pst != NULL; pst = pst->next) {
+				pst->live_count = 0;
+				pst->live_bytes = 0;
+			}
+		}
+		memset(prof_filter, 0, sizeof(prof_filter));
+		pthread_mutex_unlock(&prof_lock);
+	}
+#endif
+	if (class_count < 0)
+		mm_size_classes(NULL, 0);
+	classes_init();
+	for (i = 0; i < MAX_ARENAS; i++)
+		arena_reset(&arenas[i]);
+	thread_arena = &arenas[0];
+	SAY("\ndid initial lists settings\n");
 
 	SAY0("DEBUG: mm_init: calling extend_heap\n");
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-	SAY("DEBUG: mm_init: check heap before extend\n");
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+    /* Create the initial heap, the first segment of arena 0, with a free
+       block of grow_min bytes */
+    if (extend_heap(&arenas[0], grow_min/WSIZE) == NULL)
 		return -1;
 	PLIST()
 	SAY("DEBUG: mm_init: check heap after extend\n");
@@ -207,29 +814,59 @@ void *mm_malloc(size_t size)
 	size_t asize;      /* Adjusted block size */
     size_t extendsize = 0; /* Amount to extend heap if no fit */
     char *bp;
+	struct arena *ar;
 
-    if (heap_listp == 0){
-		SAY("ERROR: mm_free: heap_listp is zero, calling mm_init again");
+    if (heap_base == 0){
+		SAY("ERROR: mm_malloc: heap_base is zero, calling mm_init again");
 		mm_init();
     }
-    /* Ignore spurious requests */
-    if (size == 0)
-	return NULL;
+	/* Ignore spurious requests */
+	if (size == 0)
+		return NULL;
+
+	/* Huge requests get their own mapping, so they never grow the heap */
+	if (size >= mmap_threshold && (bp = mmap_alloc(size, DSIZE)) != NULL) {
+		NOTE_ALLOC(bp, MMAP_LEN(bp));
+		return bp;
+	}
+
+	/* Refuse what no header could describe */
+	if (size > MAX_BLOCK - DSIZE)
+		return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-	asize = 2*DSIZE;
-    else
-	asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+	/* Adjust block size to include overhead and alignment reqs. */
+	if (size <= MIN_BLOCK - WSIZE)
+		asize = MIN_BLOCK;
+	else
+		asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
 	
+	/* Reuse a recently freed block of the same size */
+	if (asize <= TCACHE_MAX_SIZE) {
+		if ((bp = tcache_get(asize)) != NULL) {
+			STAT_INC(tcache_hits);
+			NOTE_ALLOC(bp, asize);
+			return bp;
+		}
+		STAT_INC(tcache_misses);
+	}
+
 	SAY0("DEBUG: mm_malloc: calling find_fit\n");
     /* Search the free list for a fit */
-
-	int index = get_index(asize);
-    if ((bp = find_fit(asize, index)) != NULL) {
+	ar = arena_lock();
+	remote_drain(ar);
+	ar->allocs_since_grow++;
+	if ((bp = quick_get(ar, asize)) != NULL) {
+		pthread_mutex_unlock(&ar->lock);
+		NOTE_ALLOC(bp, asize);
+		return bp;
+	}
+    if ((bp = find_fit(ar, asize)) != NULL) {
 		SAY2("DEBUG: mm_malloc calling place(%p, %i)\n", bp, asize);
-		list_rm(bp);
-		place(bp, asize);
+		list_rm(ar, bp);
+		place(ar, bp, asize);
+		asize = GET_SIZE(HDRP(bp));	/* What place left it, under the lock */
+		pthread_mutex_unlock(&ar->lock);
+		NOTE_ALLOC(bp, asize);
 		SAY2("DEBUG: mm_malloc returning %p, size: %i\n", bp, GET_SIZE(HDRP(bp)));
 		SAY("DEBUG: mm_malloc printing list before return:\n");
 		PLIST()
@@ -239,12 +876,17 @@ void *mm_malloc(size_t size)
 
     /* No fit found. Get more memory and place the block */
     
-	extendsize = MAX(asize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+	extendsize = MAX(asize, grow_heap_size(ar));
+    if ((bp = extend_heap(ar, extendsize/WSIZE)) == NULL) {
+		pthread_mutex_unlock(&ar->lock);
 		return NULL;
+	}
 	SAY2("DEBUG: mm_malloc calling place(%p, %i)\n", bp, asize);
-	list_rm(bp);
-    place(bp, asize);
+	list_rm(ar, bp);
+    place(ar, bp, asize);
+	asize = GET_SIZE(HDRP(bp));
+	pthread_mutex_unlock(&ar->lock);
+	NOTE_ALLOC(bp, asize);
 	SAY1("DEBUG: mm_malloc returning %p\n", bp);
 	SAY("DEBUG: mm_malloc printing list:\n");
 	PLIST()
@@ -261,90 +903,552 @@ void mm_free(void *bp)
 	SAY1("DEBUG: mm_free: called on [%p]\n", bp);
 	SAY("DEBUG: mm_free: checking heap:\n");
 	CHEAP()
-    if(bp == 0) 
-	return;
+	if (bp == 0)
+		return;
+	NOTE_FREE(bp);
 
-    size_t size = GET_SIZE(HDRP(bp));
-    if (heap_listp == 0){
-		SAY("ERROR: mm_free: heap_listp is zero, calling mm_init again\n");
+	/* Mapped blocks go straight back to the system */
+	if (GET_OWN(bp) & MMAPPED) {
+		mmap_free(bp);
+		return;
+	}
+
+    size_t size = GET_OWN(bp) & ~(word_t)0x7;
+	struct arena *ar;
+    if (heap_base == 0){
+		SAY("ERROR: mm_free: heap_base is zero, calling mm_init again\n");
 		mm_init();
     }
 
 	/* CASE: mm_free is passed a value that is outside the heap */
-	if ((void*)heap_lastp < bp || (void*)heap_listp > bp) {
+	if ((ar = arena_of(bp)) == NULL) {
 		/* You can't free it then! */
 		return;
 	}
+
+	/* Small blocks are parked in the thread cache, no list traffic */
+	if (size <= TCACHE_MAX_SIZE && tcache_put(bp, size))
+		return;
 	
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-	
-	/* TODO: addToList is called from within coalesce */
-    coalesce(bp);
+	/* The block goes back to the arena it came from. If that is not this
+	   thread's arena, leave it for the owner rather than wait for its lock */
+	if (ar != thread_arena) {
+		remote_free(ar, bp);
+		return;
+	}
+	pthread_mutex_lock(&ar->lock);
+	remote_drain(ar);
+	free_block(ar, bp);
 	SAY1("DEBUG: mm_free: removed block [%p]\n", bp);
+
+	/* Give memory back once enough has been freed since the last time */
+	if (trim_threshold >= 0 && (ar->freed_since_trim += size) > (size_t)trim_threshold)
+		arena_trim(ar, top_pad);
+	pthread_mutex_unlock(&ar->lock);
 	PLIST()
 	CHEAP()
 }
 
+/*
+ * mm_calloc - Allocate zeroed space for nmemb objects of size bytes.
+ * Mappings come zeroed from the kernel. A heap block whose ZEROED bit
+ * was set only needs its old links and footer cleared; anything else
+ * gets a full memset.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+	size_t bytes, asize;
+	struct arena *ar;
+	char *bp;
+	int zero;
+
+	if (size != 0 && nmemb > ~(size_t)0 / size)
+		return NULL;
+	bytes = nmemb * size;
+	if (heap_base == 0)
+		mm_init();
+	if (bytes == 0)
+		return NULL;
+
+	if (bytes >= mmap_threshold && (bp = mmap_alloc(bytes, DSIZE)) != NULL) {
+		NOTE_ALLOC(bp, MMAP_LEN(bp));
+		return bp;
+	}
+	if (bytes > MAX_BLOCK - DSIZE) {
+		if ((bp = mm_malloc(bytes)) != NULL)
+			memset(bp, 0, bytes);
+		return bp;
+	}
+
+	if (bytes <= MIN_BLOCK - WSIZE)
+		asize = MIN_BLOCK;
+	else
+		asize = DSIZE * ((bytes + (WSIZE) + (DSIZE-1)) / DSIZE);
+	if (asize <= TCACHE_MAX_SIZE && (bp = tcache_get(asize)) != NULL) {
+		STAT_INC(tcache_hits);
+		NOTE_ALLOC(bp, asize);
+		memset(bp, 0, bytes);
+		return bp;
+	}
+	if (asize <= TCACHE_MAX_SIZE)
+		STAT_INC(tcache_misses);
+
+	ar = arena_lock();
+	remote_drain(ar);
+	ar->allocs_since_grow++;
+	if ((bp = quick_get(ar, asize)) != NULL) {
+		pthread_mutex_unlock(&ar->lock);
+		NOTE_ALLOC(bp, asize);
+		memset(bp, 0, bytes);
+		return bp;
+	}
+	if ((bp = find_fit(ar, asize)) == NULL &&
+		(bp = extend_heap(ar, MAX(asize, grow_heap_size(ar))/WSIZE)) == NULL) {
+		pthread_mutex_unlock(&ar->lock);
+		return NULL;
+	}
+	zero = (GET(HDRP(bp)) & ZEROED) != 0;
+	list_rm(ar, bp);
+	place(ar, bp, asize);
+	asize = GET_SIZE(HDRP(bp));
+	pthread_mutex_unlock(&ar->lock);
+	NOTE_ALLOC(bp, asize);
+
+	SAY2("DEBUG: mm_calloc: [%p] was %s\n", bp, zero ? "zero" : "dirty");
+	if (zero) {
+		/* Old links, and the old footer if the block was not split */
+		memset(bp, 0, MIN(4*WSIZE, bytes));
+		PUT((char *)bp + asize - DSIZE, 0);
+	}
+	else
+		memset(bp, 0, bytes);
+	return bp;
+}
+
+/*
+ * mm_memalign - Allocate size bytes at a multiple of alignment, which is
+ * rounded up to a power of two. find_fit is asked for a block with room
+ * to slide the payload up to the first aligned address at least
+ * MIN_BLOCK in, so the gap in front can be split off as a free block of
+ * its own; place then gives the tail back as usual. Huge requests get an
+ * aligned mapping.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+	size_t asize, csize, need, lead;
+	struct arena *ar;
+	char *bp, *ap;
+	word_t zero;
+
+	if (alignment <= DSIZE)
+		return mm_malloc(size);
+	if (alignment > (~(size_t)0 >> 1))
+		return NULL;
+	if (alignment & (alignment - 1))
+		alignment = 1UL << (8*sizeof(unsigned long) - __builtin_clzl(alignment));
+	if (heap_base == 0)
+		mm_init();
+	if (size == 0 || alignment == 0)
+		return NULL;
+
+	if (size >= mmap_threshold || alignment > MAX_BLOCK / 4 ||
+		size > MAX_BLOCK - 2*alignment) {
+		if ((bp = mmap_alloc(size, alignment)) != NULL)
+			NOTE_ALLOC(bp, MMAP_LEN(bp));
+		return bp;
+	}
+
+	if (size <= MIN_BLOCK - WSIZE)
+		asize = MIN_BLOCK;
+	else
+		asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+	/* alignment is at least MIN_BLOCK, so at most this much is skipped */
+	need = asize + alignment + MIN_BLOCK - DSIZE;
+
+	ar = arena_lock();
+	remote_drain(ar);
+	ar->allocs_since_grow++;
+	if ((bp = find_fit(ar, need)) == NULL &&
+		(bp = extend_heap(ar, MAX(need, grow_heap_size(ar))/WSIZE)) == NULL) {
+		pthread_mutex_unlock(&ar->lock);
+		return NULL;
+	}
+	list_rm(ar, bp);
+
+	ap = (char *)(((unsigned long)bp + (alignment-1)) & ~(unsigned long)(alignment-1));
+	if (ap != bp && ap - bp < MIN_BLOCK)
+		ap += alignment;
+	if (ap != bp) {
+		/* The gap becomes a free block. Its neighbours are both allocated */
+		lead = ap - bp;
+		csize = GET_SIZE(HDRP(bp));
+		zero = GET(HDRP(bp)) & ZEROED;
+		PUT(HDRP(bp), PACK(lead, 0) | GET_PREV_ALLOC(HDRP(bp)) | zero);
+		PUT(FTRP(bp), PACK(lead, 0));
+		/* Looks free for place's sake, but is on no list */
+		PUT(HDRP(ap), PACK(csize - lead, 0) | zero);
+		list_add(ar, bp);
+	}
+	SAY3("DEBUG: mm_memalign: [%p] for %lu at %lu\n", ap, (unsigned long)size, (unsigned long)alignment);
+	place(ar, ap, asize);
+	asize = GET_SIZE(HDRP(ap));
+	pthread_mutex_unlock(&ar->lock);
+	NOTE_ALLOC(ap, asize);
+	return ap;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc: like mm_memalign, but an
+ * alignment that is not a power of two is an error.
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)))
+		return NULL;
+	return mm_memalign(alignment, size);
+}
+
+/*
+ * mm_free_sized - mm_free for a caller that knows the size it asked for.
+ * A small size means a small block, so the arena map lookup is enough to
+ * tell it is a heap block, and the block goes to the thread cache without
+ * the mapped block check of mm_free. It is binned and counted by the
+ * size in its header, which place may have left up to MIN_BLOCK - DSIZE
+ * over the rounded request. Everything else takes the mm_free path.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+	size_t asize, bsize;
+
+	if (bp == NULL)
+		return;
+	if (size <= MIN_BLOCK - WSIZE)
+		asize = MIN_BLOCK;
+	else
+		asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+
+	if (asize <= TCACHE_MAX_SIZE && heap_base != 0 && arena_of(bp) != NULL) {
+#if SIZED_FREE_CHECK
+		/* mm_malloc leaves less than MIN_BLOCK of slack in a block */
+		if (GET_ALLOC(HDRP(bp)) == 0 || GET_SIZE(HDRP(bp)) < asize ||
+			GET_SIZE(HDRP(bp)) - asize >= MIN_BLOCK)
+		{
+			printf("Error: mm_free_sized: %p is not a block of %lu bytes\n", bp, (unsigned long)size);
+			Assert(0==1);
+		}
+#endif
+		bsize = GET_OWN(bp) & ~(word_t)0x7;
+		if (bsize <= TCACHE_MAX_SIZE) {
+			NOTE_FREE(bp);
+			tcache_put(bp, bsize);
+			return;
+		}
+	}
+	mm_free(bp);
+}
+
+/*
+ * mm_usable_size - Return the payload bp really has, which may be more
+ * than was asked for: the request rounded up to the pages of its mapping,
+ * or to its block less the header.
+ */
+size_t mm_usable_size(void *bp)
+{
+	if (bp == NULL)
+		return 0;
+	if (GET_OWN(bp) & MMAPPED)
+		return MMAP_LEN(bp) - ((char *)bp - MMAP_BASE(bp));
+	return (GET_OWN(bp) & ~(word_t)0x7) - WSIZE;
+}
+
+/*
+ * mm_footprint - Return the memory the allocator holds: the heap and
+ * every block mapped on its own.
+ */
+size_t mm_footprint(void)
+{
+	return mem_heapsize() + __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * mm_stats - Fill in *st: the counters summed over every thread, and a
+ * census of the free lists, which locks each arena in turn.
+ * Counters read zero in a build with MM_STATS=0.
+ */
+void mm_stats(struct mm_stats *st)
+{
+	struct arena *ar;
+	size_t total = 0;
+	int i, fl, sl, k;
+	void *bp;
+
+	memset(st, 0, sizeof(*st));
+	if (heap_base == 0)
+		return;
+
+	for (i = 0; i < MAX_ARENAS; i++) {
+		ar = &arenas[i];
+		pthread_mutex_lock(&ar->lock);
+		for (fl = 0; fl < FL_COUNT; fl++)
+			for (sl = 0; sl < SL_COUNT; sl++)
+				for (bp = ar->lists[fl][sl]; bp != NULL; bp = BP_TO_NEXT_FREE(bp)) {
+					k = 63 - __builtin_clzl(GET_SIZE(HDRP(bp)));
+					st->free_blocks[k]++;
+					st->free_bytes[k] += GET_SIZE(HDRP(bp));
+					st->largest_free = MAX(st->largest_free, GET_SIZE(HDRP(bp)));
+				}
+		for (fl = 0; fl < QUICK_BINS; fl++)
+			for (bp = ar->quick[fl]; bp != NULL; bp = BP_TO_NEXT_FREE(bp)) {
+				k = 63 - __builtin_clzl(GET_SIZE(HDRP(bp)));
+				st->free_blocks[k]++;
+				st->free_bytes[k] += GET_SIZE(HDRP(bp));
+			}
+		pthread_mutex_unlock(&ar->lock);
+	}
+	for (k = 0; k < MM_STATS_CLASSES; k++)
+		total += st->free_bytes[k];
+	st->fragmentation = total ? 1.0 - (double)st->largest_free / total : 0;
+	st->heap_bytes = mm_footprint();
+
+#if MM_STATS
+	{
+		struct thread_stats sum;
+
+		stats_peak();
+		stats_sum(&sum);
+		memcpy(st->mallocs, sum.mallocs, sizeof(st->mallocs));
+		memcpy(st->frees, sum.frees, sizeof(st->frees));
+		st->tcache_hits = sum.tcache_hits;
+		st->tcache_misses = sum.tcache_misses;
+		st->realloc_inplace = sum.realloc_inplace;
+		st->realloc_copies = sum.realloc_copies;
+		st->realloc_copied = sum.realloc_copied;
+		st->realloc_saved = sum.realloc_saved;
+		st->extends = sum.extends;
+		st->fits = sum.fits;
+		st->fit_exact = sum.fit_exact;
+		st->fit_excess = sum.fit_excess;
+		memcpy(st->fit_scans, sum.fit_scans, sizeof(st->fit_scans));
+		st->live_bytes = sum.live > 0 ? sum.live : 0;
+		/* live_total lags the sum by up to LIVE_FLUSH a thread */
+		stats_max(&peak_live, st->live_bytes);
+		st->peak_live_bytes = __atomic_load_n(&peak_live, __ATOMIC_RELAXED);
+		st->peak_heap_bytes = __atomic_load_n(&peak_footprint, __ATOMIC_RELAXED);
+	}
+#endif
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out[]. Cached
+ * blocks are used first; the rest are carved side by side out of one
+ * free block of n * asize bytes, found or made with a single find_fit or
+ * extend_heap, and split only once, after the last of them. Returns the
+ * number of blocks allocated, which is less than n only if memory ran out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+	size_t asize, csize, got = 0, k, i;
+	struct arena *ar;
+	char *bp;
+	word_t zero;
+
+	if (heap_base == 0)
+		mm_init();
+	if (size == 0 || n == 0)
+		return 0;
+
+	if (size < mmap_threshold && size <= MAX_BLOCK - DSIZE) {
+		if (size <= MIN_BLOCK - WSIZE)
+			asize = MIN_BLOCK;
+		else
+			asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+		if (asize <= TCACHE_MAX_SIZE)
+			for (; got < n && (out[got] = tcache_get(asize)) != NULL; got++)
+				;
+
+		ar = arena_lock();
+		remote_drain(ar);
+		while (got < n) {
+			k = MIN(n - got, MAX_BLOCK / asize);
+			ar->allocs_since_grow += k;
+			if ((bp = find_fit(ar, k * asize)) == NULL &&
+				(bp = extend_heap(ar, MAX(k * asize, grow_heap_size(ar))/WSIZE)) == NULL)
+				break;
+			list_rm(ar, bp);
+			csize = GET_SIZE(HDRP(bp));
+			zero = GET(HDRP(bp)) & ZEROED;
+			SAY3("DEBUG: mm_malloc_batch: %lu blocks of %u from [%p]\n", (unsigned long)k, (unsigned int)asize, bp);
+
+			/* Every block but the last is cut off the front as it stands */
+			for (i = 1; i < k; i++) {
+				PUT(HDRP(bp), PACK(asize, 1) | GET_PREV_ALLOC(HDRP(bp)));
+				out[got++] = bp;
+				bp = NEXT_BLKP(bp);
+				PUT(HDRP(bp), PACK(csize - i * asize, 0) | PREV_ALLOC | zero);
+			}
+			place(ar, bp, asize);
+			out[got++] = bp;
+		}
+		pthread_mutex_unlock(&ar->lock);
+	}
+
+#if MM_STATS || MM_PROFILE
+	for (i = 0; i < got; i++)
+		NOTE_ALLOC(out[i], block_bytes(out[i]));
+#endif
+
+	/* Mapped sizes, and whatever could not be had in bulk, one at a time */
+	for (; got < n; got++)
+		if ((out[got] = mm_malloc(size)) == NULL)
+			break;
+	return got;
+}
+
+/*
+ * mm_free_batch - Free n blocks. The pointers are sorted by address (in
+ * place, so ptrs is reordered), which brings neighbours together: each
+ * run of adjacent heap blocks becomes one free block and is coalesced
+ * and listed once. Blocks skip the thread cache, so they can merge.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+	struct arena *ar = NULL, *owner;
+	size_t i, size, freed = 0;
+	char *bp;
+
+	if (heap_base == 0)
+		mm_init();
+	qsort(ptrs, n, sizeof(void *), ptr_cmp);
+
+	for (i = 0; i < n; i++) {
+		bp = ptrs[i];
+		if (bp == NULL || (i > 0 && bp == ptrs[i-1]))
+			continue;
+		NOTE_FREE(bp);
+		if (GET_MMAPPED(HDRP(bp))) {
+			mmap_free(bp);
+			continue;
+		}
+		else if ((owner = arena_of(bp)) == NULL)
+			continue;
+
+		if (owner != thread_arena) {
+			remote_free(owner, bp);
+			continue;
+		}
+		if (ar == NULL) {
+			ar = owner;
+			pthread_mutex_lock(&ar->lock);
+			remote_drain(ar);
+		}
+		/* Swallow the blocks that follow bp directly */
+		size = GET_SIZE(HDRP(bp));
+		while (i + 1 < n && (char *)ptrs[i+1] == bp + size &&
+			GET_SIZE(HDRP(ptrs[i+1])) <= MAX_BLOCK - size) {
+			NOTE_FREE(ptrs[i+1]);
+			CHECK_MERGE(ar, ptrs[i+1], bp);
+			size += GET_SIZE(HDRP(ptrs[++i]));
+		}
+		SAY2("DEBUG: mm_free_batch: freeing %lu bytes at [%p]\n", (unsigned long)size, bp);
+		PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)));
+		PUT(FTRP(bp), PACK(size, 0));
+		CLR_PREV_ALLOC(NEXT_BLKP(bp));
+		coalesce(ar, bp);
+		freed += size;
+	}
+
+	if (ar != NULL) {
+		if (trim_threshold >= 0 && (ar->freed_since_trim += freed) > (size_t)trim_threshold)
+			arena_trim(ar, top_pad);
+		pthread_mutex_unlock(&ar->lock);
+	}
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+	char *p = *(char * const *)a, *q = *(char * const *)b;
+
+	return p < q ? -1 : p > q;
+}
+
 /*
  * coalesce - Boundary tag coalescing. Return ptr to coalesced block
  * Based on book code mm.c
  */
-static void *coalesce(void *bp)
+static void *coalesce(struct arena *ar, void *bp)
 {
 	SAY1("DEBUG: coalesce: entering with bp:[%p]\n",bp);
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 	SAY0("DEBUG: coalesce: size_t prev_alloc set\n");
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	SAY0("DEBUG: coalesce: size_t next_alloc set\n");
     size_t size = GET_SIZE(HDRP(bp));
+	word_t zero = GET(HDRP(bp)) & ZEROED;
 	SAY0("DEBUG: coalesce: locals declared\n");
-	
-	/* Get NEXT_FREE as an unsigned int so that we can compare it to DEADBEEF */
-	if(GET_ALLOC(FTRP(bp)))
-	{
-		SAY1("DEBUG: coalesce: ERROR: tried to remove allocated block bp:[%p] from list\n",bp)
-		list_rm(bp);
-	}
+
+	/* Never build a block too big for its header; leave such pairs apart */
+	if (!next_alloc && GET_SIZE(HDRP(NEXT_BLKP(bp))) > MAX_BLOCK - size)
+		next_alloc = 1;
+	if (!prev_alloc && GET_SIZE(HDRP(PREV_BLKP(bp))) >
+		MAX_BLOCK - size - (next_alloc ? 0 : GET_SIZE(HDRP(NEXT_BLKP(bp)))))
+		prev_alloc = 1;
+
+	/* The block before a merged block is always allocated */
 	
 	/* In each of these functions, check if the block-to-be-merged is in free list and remove it first */
     if (prev_alloc && next_alloc) {            /* Case 1 */
 		SAY1("DEBUG: coalesce: [%p] does not need to be merged. Adding to list and returning\n", bp);
-		list_add(bp);
+		list_add(ar, bp);
 		SAY1("DEBUG: coalesce: printing list and returning [%p]\n", bp);
 		//PLIST()
 		return bp;
     }
 
+	/* A merger is zero only if every part is; then clear the seams */
     else if (prev_alloc && !next_alloc) {      /* Case 2 */
-	list_rm(NEXT_BLKP(bp));
+	CHECK_MERGE(ar, NEXT_BLKP(bp), bp);
+	list_rm(ar, NEXT_BLKP(bp));
+	zero &= GET(HDRP(NEXT_BLKP(bp)));
 	size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-	PUT(HDRP(bp), PACK(size, 0));
+	if (zero)
+		zero_seam(bp, NEXT_BLKP(bp));
+	PUT(HDRP(bp), PACK(size, 0) | PREV_ALLOC | zero);
 	PUT(FTRP(bp), PACK(size,0));
     }
 
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
-	list_rm(PREV_BLKP(bp));
+	CHECK_MERGE(ar, bp, PREV_BLKP(bp));
+	list_rm(ar, PREV_BLKP(bp));
+	zero &= GET(HDRP(PREV_BLKP(bp)));
 	size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 	PUT(FTRP(bp), PACK(size, 0));
-	PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
 	bp = PREV_BLKP(bp);
+	if (zero)
+		zero_seam(bp, bp + GET_SIZE(HDRP(bp)));
+	PUT(HDRP(bp), PACK(size, 0) | PREV_ALLOC | zero);
     }
 
     else {                                     /* Case 4 */
-	list_rm(NEXT_BLKP(bp));
-	list_rm(PREV_BLKP(bp));
+	CHECK_MERGE(ar, NEXT_BLKP(bp), bp);
+	CHECK_MERGE(ar, bp, PREV_BLKP(bp));
+	list_rm(ar, NEXT_BLKP(bp));
+	list_rm(ar, PREV_BLKP(bp));
+	zero &= GET(HDRP(NEXT_BLKP(bp))) & GET(HDRP(PREV_BLKP(bp)));
 	size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
 	    GET_SIZE(FTRP(NEXT_BLKP(bp)));
-	PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
 	PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+	if (zero)
+		zero_seam(bp, NEXT_BLKP(bp));
 	bp = PREV_BLKP(bp);
+	if (zero)
+		zero_seam(bp, bp + GET_SIZE(HDRP(bp)));
+	PUT(HDRP(bp), PACK(size, 0) | PREV_ALLOC | zero);
     }
 	
 	SAY1("DEBUG: coalesce: calling list_add(bp:[%p])\n", bp);
 	
 	/* add new block to the free list */
-	list_add(bp);
+	list_add(ar, bp);
 	SAY1("DEBUG: coalesce: returning bp:[%p]\n", bp);
 	SAY0("DEBUG: coalesce: calling mm_check after list_add\n");
 	CHEAP()
@@ -353,14 +1457,16 @@ static void *coalesce(void *bp)
 }
 
 /*
- * mm_realloc - Look to see if the next block is free and can fit 
- * the requested size. If so, do that. Otherwise, call mm_malloc & mm_free. 
+ * mm_realloc - Resize in place whenever the neighbours allow it: shrink by
+ * splitting off the tail, grow into a free next block, grow the heap if
+ * the block is last, or grow into a free previous block with a memmove.
+ * Otherwise, call mm_malloc & mm_free. 
  * Based on book code mm.c
  */
 void *mm_realloc(void *ptr, size_t size)
 {
 	SAY("DEBUG: mm_realloc\n");
-    size_t oldsize;
+    size_t oldsize, payload;
     void *newptr;
 
     /* If size == 0 then this is just free, and we return NULL. */
@@ -373,245 +1479,1802 @@ void *mm_realloc(void *ptr, size_t size)
     if(ptr == NULL) {
 	return mm_malloc(size);
     }
-	
-	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
-	void* nextblock = NEXT_BLKP(ptr);
-	size_t next_size = GET_SIZE(HDRP(nextblock));
-	if(!next_alloc && next_size > 0 && nextblock != NULL)
-	{
-		size_t combo_size = next_size + GET_SIZE(HDRP(ptr));
-		size_t asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
-		SAY2("DEBUG: mm_realloc: next_alloc: [%u], next_size: [%u]\n", next_alloc, next_size);
-		if (combo_size >= size)
-		{	
-			SAY2("DEBUG: mm_realloc: asize:%i combosize:%i\n", asize, combo_size);
-			//printblock(nextblock);
-			/* delete the adjacent free block from the list */
-			list_rm(nextblock);
-			SAY("DEBUG: mm_realloc: removed from list\n");
-			/* update header of block to return*/
-			PUT(HDRP(ptr), PACK(combo_size, 0));
-			PUT(FTRP(ptr), PACK(combo_size, 0));
-			place(ptr, asize);
-			return ptr;
+
+	/* A mapped block stays mapped and is resized by the kernel, unless it
+	   has shrunk enough to belong in the heap */
+	if (GET_OWN(ptr) & MMAPPED) {
+		/* M_MMAP_THRESHOLD may have been raised since, so size can be
+		   more than the mapping holds */
+		payload = MIN(size, mm_usable_size(ptr));
+		if (size >= mmap_threshold) {
+			oldsize = MMAP_LEN(ptr);
+			if ((newptr = mmap_realloc(ptr, size)) != NULL) {
+				NOTE_RESIZE(ptr, oldsize, newptr, MMAP_LEN(newptr));
+				STAT_ADD(realloc_saved, payload);
+			}
+			return newptr;
 		}
+		if ((newptr = mm_malloc(size)) == NULL)
+			return 0;
+		memcpy(newptr, ptr, payload);
+		STAT_INC(realloc_copies);
+		STAT_ADD(realloc_copied, payload);
+		mm_free(ptr);
+		return newptr;
 	}
+	
+    size_t asize, next_size, prev_size;
+	void *nextblock, *prevblock;
+	struct arena *ar;
 
-	newptr = mm_malloc(size);
-    /* If realloc() fails the original block is left untouched  */
+	/* CASE: mm_realloc is passed a value that is outside the heap. Like
+	   any failed realloc, leave it alone and return NULL */
+	if ((ar = arena_of(ptr)) == NULL)
+		return 0;
+
+	if (size > MAX_BLOCK - DSIZE)
+		goto move;	/* Too big for the heap; mm_malloc may map it */
+	if (size <= MIN_BLOCK - WSIZE)
+		asize = MIN_BLOCK;
+	else
+		asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+
+	/* The neighbours belong to the same arena, so hold its lock */
+	pthread_mutex_lock(&ar->lock);
+	oldsize = GET_SIZE(HDRP(ptr));
+
+	/* Shrinking: split the tail off to the free lists */
+	if (asize <= oldsize)
+	{
+		SAY2("DEBUG: mm_realloc: shrinking %p to %u\n", ptr, (unsigned int)asize);
+		place(ar, ptr, asize);
+		asize = GET_SIZE(HDRP(ptr));
+		pthread_mutex_unlock(&ar->lock);
+		NOTE_RESIZE(ptr, oldsize, ptr, asize);
+		STAT_ADD(realloc_saved, size);
+		return ptr;
+	}
+
+	nextblock = NEXT_BLKP(ptr);
+	next_size = GET_ALLOC(HDRP(nextblock)) ? 0 : GET_SIZE(HDRP(nextblock));
+	if (next_size > MAX_BLOCK - oldsize)
+		next_size = 0;
+
+	/* At the end of the arena: grow the heap by just what is missing, and
+	   the new space lands in a free block right after ptr */
+	if ((next_size == 0 && (char *)nextblock == ar->heap_end) ||
+		(next_size != 0 && (char *)NEXT_BLKP(nextblock) == ar->heap_end))
+	{
+		if (oldsize + next_size < asize &&
+			extend_heap(ar, (asize - oldsize - next_size) / WSIZE) != NULL)
+		{
+			SAY1("DEBUG: mm_realloc: grew the heap under %p\n", ptr);
+			next_size = GET_SIZE(HDRP(nextblock));
+			if (next_size > MAX_BLOCK - oldsize)
+				next_size = 0;
+		}
+	}
+
+	/* Growing into a free next block: no copy at all */
+	if (next_size != 0 && oldsize + next_size >= asize)
+	{
+		SAY2("DEBUG: mm_realloc: next_size: [%u], asize: [%u]\n", (unsigned int)next_size, (unsigned int)asize);
+		CHECK_MERGE(ar, nextblock, ptr);
+		list_rm(ar, nextblock);
+		PUT(HDRP(ptr), PACK(oldsize + next_size, 1) | GET_PREV_ALLOC(HDRP(ptr)));
+		SET_PREV_ALLOC(NEXT_BLKP(ptr));
+		place(ar, ptr, asize);
+		asize = GET_SIZE(HDRP(ptr));
+		pthread_mutex_unlock(&ar->lock);
+		NOTE_RESIZE(ptr, oldsize, ptr, asize);
+		STAT_ADD(realloc_saved, oldsize - WSIZE);
+		return ptr;
+	}
+
+	/* Growing backward into a free previous block (and the next one too,
+	   if that is what it takes): slide the payload down with memmove */
+	if (!GET_PREV_ALLOC(HDRP(ptr)))
+	{
+		prevblock = PREV_BLKP(ptr);
+		prev_size = GET_SIZE(HDRP(prevblock));
+		if (next_size != 0 && oldsize + next_size + prev_size < asize)
+			next_size = 0;	/* Only take the next block if it helps */
+		if (prev_size <= MAX_BLOCK - oldsize - next_size &&
+			prev_size + oldsize + next_size >= asize)
+		{
+			SAY2("DEBUG: mm_realloc: moving %p back to %p\n", ptr, prevblock);
+			list_rm(ar, prevblock);
+			CHECK_MERGE(ar, ptr, prevblock);
+			if (next_size != 0) {
+				CHECK_MERGE(ar, nextblock, prevblock);
+				list_rm(ar, nextblock);
+			}
+			memmove(prevblock, ptr, oldsize - WSIZE);
+			STAT_ADD(realloc_copied, oldsize - WSIZE);
+			PUT(HDRP(prevblock), PACK(prev_size + oldsize + next_size, 1) | PREV_ALLOC);
+			SET_PREV_ALLOC(NEXT_BLKP(prevblock));
+			place(ar, prevblock, asize);
+			asize = GET_SIZE(HDRP(prevblock));
+			pthread_mutex_unlock(&ar->lock);
+			NOTE_RESIZE(ptr, oldsize, prevblock, asize);
+			return prevblock;
+		}
+	}
+	pthread_mutex_unlock(&ar->lock);
+
+move:
+	newptr = mm_malloc(size);
+    /* If realloc() fails the original block is left untouched  */
     if(!newptr) {
 	return 0;
-    }
+    }
+
+    /* Copy the old data: the payload is the block less its header */
+    oldsize = (GET_OWN(ptr) & ~(word_t)0x7) - WSIZE;
+    if(size < oldsize) oldsize = size;
+    memcpy(newptr, ptr, oldsize);
+	STAT_INC(realloc_copies);
+	STAT_ADD(realloc_copied, oldsize);
+
+    /* Free the old block. */
+    mm_free(ptr);
+
+    return newptr;
+}
+
+/* 
+ * mm_check - based from book code. Perform various checks on the heap state.
+ * Force program termination upon error and print helpful information.
+ * Takes no locks: nothing else may use the allocator while it runs.
+ * 
+ * Checks performed, for every arena, in time linear in the heap:
+ *					* Make sure two adjacent blocks are not free
+ *					* Verify prologue and epilogue headers, and every
+ *					  free block's footer against its header
+ *					* Check that each block's grain is owned by the arena
+ *					* Check for free blocks not in the free lists
+ *					* Check for allocated blocks in the free lists, and
+ *					  blocks listed twice or in the wrong list
+ *		
+ */
+void mm_check(int verbose)
+{
+	unsigned char *map;
+	size_t len;
+	int i, errors = 0;
+
+	if (heap_base == 0)
+		return;
+	len = mem_heapsize() / DSIZE / 8 + 1;
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (map == MAP_FAILED) {
+		printf("Error: mm_check: no memory for the free block map\n");
+		return;
+	}
+	for (i = 0; i < MAX_ARENAS; i++)
+		if (arenas[i].heap_listp != NULL)
+			errors += arena_check(&arenas[i], map, verbose);
+	munmap(map, len);
+	Assert(errors == 0);
+}
+
+/*
+ * arena_check - mm_check for one arena. The walk over its blocks sets
+ * the map bit of every free block, and the pass over its lists
+ * clears the bit of each block it meets; meeting a clear bit means the
+ * entry is not a free block, or is listed twice. Bits left set at the
+ * end are free blocks no list reached. The map is clear again on return.
+ */
+static int arena_check(struct arena *ar, unsigned char *map, int verbose)
+{ 
+    char *seg, *bp = NULL;
+	void *fp, *prev;
+	size_t nfree = 0, nlisted = 0;
+	unsigned int count = 0;
+	int errors, n, fl, sl, bfl, bsl;
+
+	errors = check_heads(ar);
+
+  for (seg = ar->heap_listp; seg != NULL; seg = GET_PTR(seg)) {
+    if (verbose)
+	SAY1("DEBUG: mm_check: Segment (%p):\n", seg);
+
+    if ((GET_SIZE(HDRP(seg)) != DSIZE) || !GET_ALLOC(HDRP(seg)))
+	{
+		printf("Error: mm_check: bad prologue header at %p\n", seg);
+		errors++;
+	}
+    for (bp = seg; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		if (verbose) 
+			printblock(bp);
+		if ((n = checkblock(ar, bp)) < 0)
+			return errors + 1;
+		errors += n;
+		if (!GET_ALLOC(HDRP(bp))) {
+			MAP_SET(map, bp);
+			nfree++;
+		}
+    }
+    if (verbose)
+	printblock(bp);
+    if (!GET_ALLOC(HDRP(bp)))
+	{
+		printf("Error: mm_check: bad epilogue header at %p\n", bp);
+		errors++;
+	}
+  }
+	if (bp != ar->heap_end)
+	{
+		printf("Error: mm_check: arena ends at %p, not %p\n", bp, ar->heap_end);
+		errors++;
+	}
+
+	/* Each list entry must be a marked block, filed under its own size */
+	for (fl = 0; fl < FL_COUNT; fl++)
+		for (sl = 0; sl < SL_COUNT; sl++)
+			for (prev = NULL, fp = ar->lists[fl][sl]; fp != NULL;
+				prev = fp, fp = BP_TO_NEXT_FREE(fp)) {
+				if (!IN_HEAP(fp) || !MAP_TEST(map, fp))
+				{
+					printf("Error: mm_check: %p in list %d/%d is not a free block, or is listed twice\n", fp, fl, sl);
+					errors++;
+					break;	/* The list may loop */
+				}
+				MAP_CLR(map, fp);
+				nlisted++;
+				get_index(GET_SIZE(HDRP(fp)), &bfl, &bsl);
+				if (bfl != fl || bsl != sl || BP_TO_PREV_FREE(fp) != prev)
+				{
+					printf("Error: mm_check: block %p misfiled or mislinked in list %d/%d\n", fp, fl, sl);
+					errors++;
+				}
+			}
+
+	/* Name the free blocks that nothing reached, clearing their bits */
+	if (nlisted != nfree)
+		for (seg = ar->heap_listp; seg != NULL; seg = GET_PTR(seg))
+			for (bp = seg; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+				if (!GET_ALLOC(HDRP(bp)) && MAP_TEST(map, bp))
+				{
+					printf("Error: mm_check: free block %p is in no list\n", bp);
+					MAP_CLR(map, bp);
+					errors++;
+				}
+
+	/* Check the quick lists: allocated blocks of their list's size */
+	for (fl = 0; fl < QUICK_BINS; fl++)
+		for (fp = ar->quick[fl]; fp != NULL && count <= ar->quick_count;
+			fp = BP_TO_NEXT_FREE(fp), count++)
+			if (!IN_HEAP(fp) || !GET_ALLOC(HDRP(fp)) ||
+				GET_SIZE(HDRP(fp)) != (size_t)fl * DSIZE || arena_of(fp) != ar)
+			{
+				printf("Error: mm_check: bad block %p on quick list %d\n", fp, fl);
+				errors++;
+				break;
+			}
+	if (count != ar->quick_count)
+	{
+		printf("Error: mm_check: %u blocks on quick lists, %u counted\n", count, ar->quick_count);
+		errors++;
+	}
+	return errors;
+}
+
+/*
+ * mm_check_step - Check the next blocks blocks of the heap, under the lock
+ * of the arena they are in, so it can run while other threads allocate.
+ * Each call moves on from where the last one stopped. Every block gets
+ * the checks of mm_check's heap walk, and every free block must be linked
+ * from the list entry before it and to the one after it. A pass
+ * over an arena starts with its list heads and bitmaps. Returns -1 if
+ * anything was wrong (and printed), 1 if the call finished a pass over
+ * the whole heap, else 0.
+ */
+int mm_check_step(size_t blocks)
+{
+	static unsigned int check_arena;	/* Arena the next call looks at */
+	struct arena *ar;
+	char *bp;
+	unsigned int i, tries;
+	int errors = 0, n, done = 0;
+
+	if (heap_base == 0)
+		return 0;
+	i = __atomic_load_n(&check_arena, __ATOMIC_RELAXED) % MAX_ARENAS;
+
+	/* Skip the arenas that have no heap */
+	for (tries = 0; tries < MAX_ARENAS; tries++, i = (i + 1) % MAX_ARENAS)
+		if (arenas[i].heap_listp != NULL)
+			break;
+	if (tries == MAX_ARENAS)
+		return 0;
+	ar = &arenas[i];
+	pthread_mutex_lock(&ar->lock);
+
+	if (ar->check_at == NULL) {
+		errors += check_heads(ar);
+		ar->check_seg = ar->heap_listp;
+		ar->check_at = ar->heap_listp;
+	}
+	for (bp = ar->check_at; blocks > 0; blocks--) {
+		if (GET_SIZE(HDRP(bp)) == 0) {
+			/* An epilogue: on to the next segment, or done */
+			if (!GET_ALLOC(HDRP(bp))) {
+				printf("Error: mm_check_step: bad epilogue header at %p\n", bp);
+				errors++;
+			}
+			if ((ar->check_seg = GET_PTR(ar->check_seg)) == NULL) {
+				if (bp != ar->heap_end) {
+					printf("Error: mm_check_step: arena ends at %p, not %p\n", bp, ar->heap_end);
+					errors++;
+				}
+				bp = NULL;
+				break;
+			}
+			bp = ar->check_seg;
+			continue;
+		}
+		if ((n = checkblock(ar, bp)) < 0) {
+			/* Cannot go on from here; start over next time */
+			errors++;
+			bp = NULL;
+			break;
+		}
+		errors += n;
+		if (!GET_ALLOC(HDRP(bp)))
+			errors += check_links(ar, bp);
+		bp = NEXT_BLKP(bp);
+	}
+	ar->check_at = bp;
+	pthread_mutex_unlock(&ar->lock);
+
+	if (bp == NULL) {
+		/* This arena is done; the pass is if no later arena has a heap */
+		for (i++; i < MAX_ARENAS && arenas[i].heap_listp == NULL; i++)
+			;
+		done = i == MAX_ARENAS;
+		__atomic_store_n(&check_arena, i % MAX_ARENAS, __ATOMIC_RELAXED);
+	}
+	return errors ? -1 : done;
+}
+
+/*
+ * check_links - bp is a free block: its list neighbours must be free
+ * blocks of the same list that point back at it, and the first of a list
+ * must be its head.
+ */
+static int check_links(struct arena *ar, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	void *prev, *next;
+	int fl, sl, nfl = -1, nsl = -1;
+
+	get_index(size, &fl, &sl);
+	prev = BP_TO_PREV_FREE(bp);
+	next = BP_TO_NEXT_FREE(bp);
+	if (prev == NULL ? ar->lists[fl][sl] != bp :
+		!is_free_block(ar, prev) || BP_TO_NEXT_FREE(prev) != bp)
+	{
+		printf("Error: mm_check: free block %p is not in list %d/%d\n", bp, fl, sl);
+		return 1;
+	}
+	if (next != NULL) {
+		if (is_free_block(ar, next))
+			get_index(GET_SIZE(HDRP(next)), &nfl, &nsl);
+		if (!is_free_block(ar, next) || BP_TO_PREV_FREE(next) != bp || nfl != fl || nsl != sl)
+		{
+			printf("Error: mm_check: bad link from %p to %p in list %d/%d\n", bp, next, fl, sl);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * check_heads - The parts of an arena's free index that the block walks
+ * do not reach: every list head, the bitmaps and the first
+ * block of each quick list.
+ */
+static int check_heads(struct arena *ar)
+{
+	void *bp;
+	int fl, sl, bfl = -1, bsl = -1, errors = 0;
+
+	for (fl = 0; fl < FL_COUNT; fl++) {
+		if (((ar->fl_bitmap >> fl) & 1) != (ar->sl_bitmap[fl] != 0))
+		{
+			printf("Error: mm_check: first level bitmap wrong for %d\n", fl);
+			errors++;
+		}
+		for (sl = 0; sl < SL_COUNT; sl++) {
+			bp = ar->lists[fl][sl];
+			/* The bitmaps must agree with the lists */
+			if (((ar->sl_bitmap[fl] >> sl) & 1) != (bp != NULL))
+			{
+				printf("Error: mm_check: bitmap wrong for list %d/%d\n", fl, sl);
+				errors++;
+			}
+			if (bp == NULL)
+				continue;
+			if (is_free_block(ar, bp))
+				get_index(GET_SIZE(HDRP(bp)), &bfl, &bsl);
+			if (!is_free_block(ar, bp) || bfl != fl || bsl != sl || BP_TO_PREV_FREE(bp) != NULL)
+			{
+				printf("Error: mm_check: bad head %p of list %d/%d\n", bp, fl, sl);
+				errors++;
+			}
+		}
+	}
+	if ((ar->fl_bitmap >> FL_COUNT) != 0)
+	{
+		printf("Error: mm_check: first level bitmap out of range\n");
+		errors++;
+	}
+	for (fl = 0; fl < QUICK_BINS; fl++) {
+		bp = ar->quick[fl];
+		if (bp != NULL && (!IN_HEAP(bp) || arena_of(bp) != ar || !GET_ALLOC(HDRP(bp)) ||
+			GET_SIZE(HDRP(bp)) != (size_t)fl * DSIZE))
+		{
+			printf("Error: mm_check: bad block %p on quick list %d\n", bp, fl);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+static int is_free_block(struct arena *ar, void *p)
+{
+	return IN_HEAP(p) && (char *)p < ar->heap_end && arena_of(p) == ar &&
+		!GET_ALLOC(HDRP(p)) && GET_SIZE(HDRP(p)) >= MIN_BLOCK;
+}
+
+/* 
+ * extend_heap - Extend heap with free block and return its block pointer
+ */
+ 
+static void *extend_heap(struct arena *ar, size_t words)
+{
+	STAT_INC(extends);
+	SAY0("DEBUG: extend_heap: entering\n");
+    char *bp;
+    size_t size;
+	
+    /* Allocate an even number of words to maintain alignment */
+    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+    if (size > MAX_BLOCK)
+		return NULL;
+    if ((bp = arena_sbrk(ar, size)) == NULL)  
+		return NULL;
+	SAY1("DEBUG: extend_heap: mem_sbrk(%u) has returned successfully\n", size);
+	if (prefault) {
+		/* Write one byte per page, clear of the block's header and links */
+		size_t page = mem_pagesize();
+		unsigned long p = ((unsigned long)bp + 4*WSIZE + (page-1)) & ~(page-1);
+		for (; p + 2*WSIZE < (unsigned long)bp + size; p += page)
+			*(volatile char *)p = 0;
+	}
+    /* Initialize free block header/footer and the epilogue header.
+       The old epilogue becomes the header, and knows about the block before */
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)) | (SBRK_ZEROED ? ZEROED : 0)); /* Free block header */   
+    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */   
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+
+	SAY0("DEBUG: extend_heap: free block initialized; epilogue set\n");
+	SAY0("DEBUG: extend_heap: calling coalesce\n");
+    /* Coalesce if the previous block was free */
+	SAY1("DEBUG: extend_heap: calling list_add %p\n", bp);
+	SAY1("DEBUG: extend_heap: calling coalesce(%p)\n", bp);
+	bp = coalesce(ar, bp);
+	
+	SAY("DEBUG: extend_heap: done. calling PLIST()\n");
+	//PLIST()
+	SAY("DEBUG: extend_heap: done. calling CHEAP()\n");
+	CHEAP()
+	SAY1("DEBUG: extend_heap: done. returning [%p]\n", bp);
+	return bp;
+}
+
+
+/*
+ * mm_mallopt - Set a tuning parameter. Returns 1 if accepted, else 0.
+ */
+int mm_mallopt(int param, int value)
+{
+	switch (param) {
+	case M_MMAP_THRESHOLD:
+		if (value <= 0)
+			return 0;
+		mmap_threshold = value;
+		return 1;
+	case M_TRIM_THRESHOLD:
+		trim_threshold = value;
+		return 1;
+	case M_TOP_PAD:
+		if (value < 0)
+			return 0;
+		top_pad = value;
+		return 1;
+	case M_GROW_MIN:
+		if (value < DSIZE || (size_t)value > grow_max)
+			return 0;
+		grow_min = DSIZE * (((size_t)value + (DSIZE-1)) / DSIZE);
+		return 1;
+	case M_GROW_MAX:
+		if (value <= 0 || (size_t)value < grow_min)
+			return 0;
+		grow_max = value;
+		return 1;
+	case M_PREFAULT:
+		prefault = value != 0;
+		return 1;
+	case M_ARENA_MAX:
+		if (value < 1 || value > MAX_ARENAS)
+			return 0;
+		pthread_once(&arena_once, arena_setup);
+		narenas = value;
+		return 1;
+	case M_DEFER_COALESCE:
+		if (value < 0)
+			return 0;
+		defer_limit = value;
+		return 1;
+#if MM_PROFILE
+	case M_PROFILE_RATE:
+		if (value < 0)
+			return 0;
+		if (value > 0) {
+			void *pc[2];
+
+			/* The first backtrace loads the unwinder, which allocates */
+			backtrace(pc, 2);
+		}
+		__atomic_store_n(&prof_rate, (long)value, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&prof_gen, 1, __ATOMIC_RELEASE);
+		return 1;
+	case M_PROFILE_SIGNAL: {
+		struct sigaction sa;
+
+		if (value < 0 || value >= NSIG)
+			return 0;
+		memset(&sa, 0, sizeof(sa));
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = SA_RESTART;
+		if (prof_signo != 0) {
+			sa.sa_handler = SIG_DFL;
+			sigaction(prof_signo, &sa, NULL);
+		}
+		prof_signo = 0;
+		if (value == 0)
+			return 1;
+		sa.sa_handler = prof_signal;
+		if (sigaction(value, &sa, NULL) < 0)
+			return 0;
+		prof_signo = value;
+		return 1;
+	}
+#endif
+	}
+	return 0;
+}
+
+/*
+ * mm_size_classes - Lay the free lists out as classes starting at the
+ * given request sizes, in increasing order, from the next mm_init on.
+ * Sizes that round to the same block share a class, and those from
+ * LARGE_BLOCK up are left to the TLSF lists. n = 0 restores the default: the
+ * MM_CLASSES table if one was compiled in, else TLSF. Returns 0, or -1 if
+ * the bounds are out of order or need more classes than there are lists.
+ */
+int mm_size_classes(const size_t *bounds, int n)
+{
+	unsigned int lo[LIST_COUNT];
+	size_t asize;
+	int i, count = 1;
+
+#ifdef MM_CLASSES
+	if (n == 0) {
+		bounds = mm_class_bounds;
+		n = sizeof(mm_class_bounds) / sizeof(mm_class_bounds[0]);
+	}
+#endif
+	lo[0] = 0;
+	for (i = 0; i < n; i++) {
+		if (i > 0 && bounds[i] <= bounds[i-1])
+			return -1;
+		if (bounds[i] >= LARGE_BLOCK)
+			break;
+		if (bounds[i] <= MIN_BLOCK - WSIZE)
+			asize = MIN_BLOCK;
+		else
+			asize = DSIZE * ((bounds[i] + (WSIZE) + (DSIZE-1)) / DSIZE);
+		if (asize >= LARGE_BLOCK)
+			break;
+		if (asize == lo[count-1])
+			continue;
+		if (count == LARGE_LIST)
+			return -1;
+		lo[count++] = asize;
+	}
+	memcpy(class_lo, lo, count * sizeof(lo[0]));
+	class_count = n > 0 ? count : 0;
+	return 0;
+}
+
+/*
+ * mm_trim - Give free memory back to the system, keeping pad bytes free
+ * at the end of every arena. Returns 1 if anything was released, else 0.
+ */
+int mm_trim(size_t pad)
+{
+	int i, released = 0;
+
+	if (heap_base == 0)
+		return 0;
+	for (i = 0; i < MAX_ARENAS; i++) {
+		pthread_mutex_lock(&arenas[i].lock);
+		remote_drain(&arenas[i]);
+		released |= arena_trim(&arenas[i], pad);
+		pthread_mutex_unlock(&arenas[i].lock);
+	}
+	return released;
+}
+
+/*
+ * mm_atfork_prepare - Before fork: take every allocator lock, in the
+ * order the allocator nests them, so no other thread is half way through
+ * a change when the address space is copied.
+ */
+void mm_atfork_prepare(void)
+{
+	int i;
+
+	pthread_once(&arena_once, arena_setup);
+	for (i = 0; i < MAX_ARENAS; i++)
+		pthread_mutex_lock(&arenas[i].lock);
+	pthread_mutex_lock(&heap_lock);
+#if MM_STATS
+	pthread_mutex_lock(&stats_lock);
+#endif
+#if MM_PROFILE
+	pthread_mutex_lock(&prof_lock);
+#endif
+}
+
+/*
+ * mm_atfork_parent - After fork, in the parent: let go of them all.
+ */
+void mm_atfork_parent(void)
+{
+	int i;
+
+#if MM_PROFILE
+	pthread_mutex_unlock(&prof_lock);
+#endif
+#if MM_STATS
+	pthread_mutex_unlock(&stats_lock);
+#endif
+	pthread_mutex_unlock(&heap_lock);
+	for (i = MAX_ARENAS - 1; i >= 0; i--)
+		pthread_mutex_unlock(&arenas[i].lock);
+}
+
+/*
+ * mm_atfork_child - After fork, in the child: the only thread left holds
+ * every lock, so it can just release them. Blocks cached by the threads
+ * that did not come along are lost to the child.
+ */
+void mm_atfork_child(void)
+{
+	mm_atfork_parent();
+}
+
+/*
+ * arena_trim - mm_trim for one arena, whose lock the caller holds.
+ */
+static int arena_trim(struct arena *ar, size_t pad)
+{
+	char *bp = ar->heap_end;	/* Just past the epilogue */
+	size_t size, release, keep;
+	int released = 0;
+
+	ar->freed_since_trim = 0;
+	if (ar->heap_listp == NULL)
+		return 0;
+	quick_consolidate(ar);
+
+	/* Cut the arena back if it ends in a big free block */
+	if (!GET_PREV_ALLOC(HDRP(bp))) {
+		bp = PREV_BLKP(bp);
+		size = GET_SIZE(HDRP(bp));
+		keep = MAX(pad, MIN_BLOCK);
+		keep = DSIZE * ((keep + (DSIZE-1)) / DSIZE);
+		release = size > keep ? (size - keep) & ~(mem_pagesize()-1) : 0;
+		SAY2("DEBUG: mm_trim: last block [%p], releasing %lu\n", bp, (unsigned long)release);
+		if (release > 0 && arena_shrink(ar, bp, release))
+			released = 1;
+		else if (release > 0 && !(GET(HDRP(bp)) & ZEROED) && purge_block(bp) > 0)
+			released = 1;
+	}
+
+	/* Drop the pages inside every other large free block */
+	if (purge_large(ar) > 0)
+		released = 1;
+	return released;
+}
+
+/*
+ * arena_shrink - Cut release bytes off bp, the free block at the end of
+ * the arena, with a negative mem_sbrk. That is only possible if mem_sbrk
+ * can shrink and no other arena has grown the heap past this one.
+ */
+static int arena_shrink(struct arena *ar, void *bp, size_t release)
+{
+#if MEM_SBRK_SHRINKS
+	size_t size = GET_SIZE(HDRP(bp));
+	char *end = ar->heap_end;
+
+	pthread_mutex_lock(&heap_lock);
+	if ((char *)mem_heap_hi() + 1 != end) {
+		pthread_mutex_unlock(&heap_lock);
+		return 0;
+	}
+	list_rm(ar, bp);
+	size -= release;
+	ar->heap_end -= release;
+	if ((char *)ar->check_at > (char *)bp)
+		ar->check_at = bp;
+	for (; release > 0; release -= MIN(release, SBRK_STEP))
+		mem_sbrk(-(int)MIN(release, SBRK_STEP));
+	/* Grains wholly past the new end belong to nobody now */
+	arena_mark(heap_base + ((ar->heap_end - heap_base + ARENA_GRAIN-1) & ~(ARENA_GRAIN-1)), end, 0);
+	pthread_mutex_unlock(&heap_lock);
+	PUT(HDRP(bp), PACK(size, 0) | (GET(HDRP(bp)) & (PREV_ALLOC | ZEROED)));
+	PUT(FTRP(bp), PACK(size, 0));
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));	/* New epilogue header */
+	list_add(ar, bp);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * purge_block - madvise away the page-aligned middle of a free block.
+ * The header, list links and the footer stay resident. The bits
+ * of page on either side are cleared by hand, so the block can be marked
+ * ZEROED, which also keeps later trims from purging it again. Returns the
+ * bytes given back to the system, 0 if the block holds no whole page.
+ */
+static size_t purge_block(void *bp)
+{
+	size_t page = mem_pagesize();
+	unsigned long lo = (unsigned long)bp + 4*WSIZE;	/* Past the links and the two words after */
+	unsigned long hi = (unsigned long)FTRP(bp);
+	unsigned long start = (lo + (page-1)) & ~(page-1);
+	unsigned long end = hi & ~(page-1);
+
+	if (end > start) {
+		madvise((void *)start, end - start, MADV_DONTNEED);
+		memset((void *)lo, 0, start - lo);
+		memset((void *)end, 0, hi - end);
+	}
+	else {
+		memset((void *)lo, 0, hi - lo);
+		end = start;
+	}
+	PUT(HDRP(bp), GET(HDRP(bp)) | ZEROED);
+	return end - start;
+}
+
+/*
+ * purge_large - purge_block every large free block not purged already,
+ * stopping once the dirty_large blocks that need it are done. Freed
+ * blocks go on the front of their lists, so a first pass looks only as
+ * far as the first purged block of each list. Only if that misses some
+ * does a second pass walk the lists to the end.
+ */
+static size_t purge_large(struct arena *ar)
+{
+	size_t bytes = 0;
+	void *bp;
+	int k, pass;
+
+	for (pass = 0; pass < 2; pass++)
+		for (k = LARGE_LIST; k < LIST_COUNT && ar->dirty_large > 0; k++)
+			for (bp = ar->lists[k >> SL_LOG2][k & (SL_COUNT - 1)];
+				bp != NULL && ar->dirty_large > 0; bp = BP_TO_NEXT_FREE(bp)) {
+				if (!(GET(HDRP(bp)) & ZEROED)) {
+					bytes += purge_block(bp);
+					ar->dirty_large--;
+				}
+				else if (pass == 0)
+					break;
+			}
+	/* A block purged by arena_trim itself leaves the count high */
+	ar->dirty_large = 0;
+	return bytes;
+}
+
+/*
+ * mmap_alloc - Map enough whole pages for the payload plus MMAP_HDR, and
+ * mark the header so mm_free and mm_realloc know what it is. For an
+ * alignment above DSIZE, map align bytes more, then unmap the whole
+ * pages before and after the aligned block.
+ */
+static void *mmap_alloc(size_t size, size_t align)
+{
+	size_t page = mem_pagesize();
+	size_t len;
+	char *map, *bp, *base, *end;
+
+	if (align <= DSIZE)
+		align = 0;
+	if (size > ~(size_t)0 - MMAP_HDR - align - page)
+		return NULL;	/* size is so big the rounding would wrap */
+	len = (size + MMAP_HDR + align + (page-1)) & ~(page-1);
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	bp = map + MMAP_HDR;
+	if (align != 0) {
+		bp = (char *)(((unsigned long)bp + (align-1)) & ~(unsigned long)(align-1));
+		base = MMAP_BASE(bp);
+		end = (char *)(((unsigned long)bp + size + (page-1)) & ~(unsigned long)(page-1));
+		if (base > map)
+			munmap(map, base - map);
+		if (end < map + len)
+			munmap(end, map + len - end);
+		len = end - base;
+	}
+	MMAP_LEN(bp) = len;
+	PUT(bp - WSIZE, PACK(0, 1) | PREV_ALLOC | MMAPPED);
+	__atomic_add_fetch(&mmap_bytes, len, __ATOMIC_RELAXED);
+	STAT_PEAK();
+	SAY2("DEBUG: mmap_alloc: [%p] for %lu bytes\n", bp, (unsigned long)size);
+	return bp;
+}
+
+/*
+ * mmap_realloc - Grow or shrink a mapping in place if the kernel can,
+ * or let it move the pages elsewhere without copying them. The block
+ * keeps its offset into the first page.
+ */
+static void *mmap_realloc(void *bp, size_t size)
+{
+	size_t page = mem_pagesize();
+	char *map = MMAP_BASE(bp);
+	size_t off = (char *)bp - map;
+	size_t len = (size + off + (page-1)) & ~(page-1);
+
+	if (len < size)
+		return NULL;
+	if (len == MMAP_LEN(bp))
+		return bp;
+	map = mremap(map, MMAP_LEN(bp), len, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED)
+		return NULL;
+	__atomic_add_fetch(&mmap_bytes, len - MMAP_LEN(map + off), __ATOMIC_RELAXED);
+	MMAP_LEN(map + off) = len;
+	return map + off;
+}
+
+/*
+ * mmap_free - Unmap a mapped block, header and all.
+ */
+static void mmap_free(void *bp)
+{
+	__atomic_sub_fetch(&mmap_bytes, MMAP_LEN(bp), __ATOMIC_RELAXED);
+	munmap(MMAP_BASE(bp), MMAP_LEN(bp));
+}
+
+/*
+ * grow_heap_size - Geometric growth: double the extension if the heap
+ * is growing in quick succession, halve it if growth has gone quiet.
+ */
+static size_t grow_heap_size(struct arena *ar)
+{
+	if (ar->allocs_since_grow < GROW_BURST)
+		ar->grow_size = MIN(ar->grow_size * 2, grow_max);
+	else if (ar->allocs_since_grow > GROW_IDLE)
+		ar->grow_size = MAX(ar->grow_size / 2, grow_min);
+	ar->allocs_since_grow = 0;
+	SAY1("DEBUG: grow_heap_size: growing by %lu\n", (unsigned long)ar->grow_size);
+	return ar->grow_size;
+}
+
+/*
+ * heap_sbrk - mem_sbrk takes an int, so grow the heap in SBRK_STEP pieces
+ * rather than let a large size wrap. Also refuse to grow past HEAP_SPAN,
+ * which is all a compact link word can address. Caller holds heap_lock.
+ */
+static void *heap_sbrk(size_t size)
+{
+	char *bp, *end;
+	size_t step;
+
+	if ((size_t)((char *)mem_heap_hi() + 1 - heap_base) + size > HEAP_SPAN)
+		return NULL;
+	step = size < SBRK_STEP ? size : SBRK_STEP;
+	if ((bp = mem_sbrk(step)) == (void *)-1)
+		return NULL;
+	for (end = bp + step; (size_t)(end - bp) < size; end += step) {
+		step = size - (end - bp);
+		if (step > SBRK_STEP)
+			step = SBRK_STEP;
+		if (mem_sbrk(step) != end) {
+			SAY("ERROR: heap_sbrk: heap did not grow contiguously\n");
+			return NULL;
+		}
+	}
+	STAT_PEAK();
+	return bp;
+}
+
+/*
+ * arena_setup - Give threads one arena per CPU to spread over, and set
+ * up every lock once; mm_init may run many times.
+ */
+static void arena_setup(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	narenas = ncpu < 1 ? 1 : MIN(ncpu, MAX_ARENAS);
+	for (i = 0; i < MAX_ARENAS; i++) {
+		pthread_mutex_init(&arenas[i].lock, NULL);
+		arenas[i].id = i + 1;
+	}
+}
+
+/*
+ * arena_reset - Empty an arena. It gets its first segment the first
+ * time it has to grow.
+ */
+static void arena_reset(struct arena *ar)
+{
+	memset(&ar->heap_listp, 0, sizeof(*ar) - offsetof(struct arena, heap_listp));
+	ar->grow_size = grow_min;
+}
+
+/*
+ * arena_lock - A thread keeps using the arena it used last for as long
+ * as it finds it free. When it is busy, the thread moves to the arena of
+ * the CPU it is running on now. If that is busy too (more threads than
+ * CPUs) or the CPU is unknown, it takes the next arena round-robin and
+ * waits for that one.
+ */
+static struct arena *arena_lock(void)
+{
+	struct arena *ar = thread_arena;
+	int cpu;
+
+	if (ar != NULL && pthread_mutex_trylock(&ar->lock) == 0)
+		return ar;
+	if ((cpu = sched_getcpu()) >= 0) {
+		ar = &arenas[cpu % narenas];
+		if (pthread_mutex_trylock(&ar->lock) == 0) {
+			thread_arena = ar;
+			return ar;
+		}
+	}
+	ar = &arenas[__sync_fetch_and_add(&arena_next, 1) % narenas];
+	pthread_mutex_lock(&ar->lock);
+	thread_arena = ar;
+	return ar;
+}
+
+static struct arena *arena_of(void *bp)
+{
+	size_t off = (char *)bp - heap_base;
+	unsigned char id;
+
+	if ((char *)bp < heap_base || off >= HEAP_SPAN)
+		return NULL;
+	id = arena_map[off >> ARENA_GRAIN_LOG2];
+	return id == 0 ? NULL : &arenas[id - 1];
+}
+
+static void arena_mark(char *lo, char *hi, unsigned char id)
+{
+	size_t first = (size_t)(lo - heap_base) >> ARENA_GRAIN_LOG2;
+	size_t last = (size_t)(hi - 1 - heap_base) >> ARENA_GRAIN_LOG2;
+
+	if (hi > lo)
+		memset(arena_map + first, id, last - first + 1);
+}
+
+/*
+ * arena_sbrk - Grow an arena by size bytes and return the new block,
+ * whose header is the arena's old epilogue. If another arena has taken
+ * the top of the heap since, start a new segment instead: skip to the
+ * next grain, so that no grain has two owners, and lay down a prologue
+ * and epilogue as mm_init used to. The prologue's footer word links the
+ * segment to the next one, for mm_check.
+ */
+static void *arena_sbrk(struct arena *ar, size_t size)
+{
+	char *brk, *seg, *bp;
+	size_t pad;
+
+	pthread_mutex_lock(&heap_lock);
+	brk = (char *)mem_heap_hi() + 1;
+	if (ar->heap_end == brk) {
+		if ((bp = heap_sbrk(size)) == NULL)
+			goto out;
+		seg = bp;
+	}
+	else {
+		pad = -(size_t)(brk - heap_base) & (ARENA_GRAIN-1);
+		if ((seg = heap_sbrk(pad + 4*WSIZE + size)) == NULL) {
+			bp = NULL;
+			goto out;
+		}
+		seg += pad;
+		PUT(seg, 0);                          /* Alignment padding */
+		PUT(seg + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+		PUT(seg + (2*WSIZE), 0);              /* Prologue footer: next segment */
+		PUT(seg + (3*WSIZE), PACK(0, 1) | PREV_ALLOC); /* Epilogue header */
+		if (ar->heap_listp == NULL)
+			ar->heap_listp = seg + 2*WSIZE;
+		else
+			SET(ar->last_seg, seg + 2*WSIZE);
+		ar->last_seg = seg + 2*WSIZE;
+		bp = seg + 4*WSIZE;
+	}
+	ar->heap_end = bp + size;
+	arena_mark(seg, ar->heap_end, ar->id);
+	SAY3("DEBUG: arena_sbrk: arena %d grew by %lu at %p\n", ar->id, (unsigned long)size, bp);
+out:
+	pthread_mutex_unlock(&heap_lock);
+	return bp;
+}
+
+/*
+ * free_block - The second half of mm_free: put the block on a quick list
+ * if coalescing is deferred, else merge it now. The caller holds the
+ * arena lock.
+ */
+static void free_block(struct arena *ar, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+
+	if (defer_limit > 0 && size <= QUICK_MAX_SIZE) {
+		SET_NEXT_FREE(bp, ar->quick[size / DSIZE]);
+		ar->quick[size / DSIZE] = bp;
+		if (++ar->quick_count > (unsigned int)defer_limit)
+			quick_consolidate(ar);
+		return;
+	}
+	merge_block(ar, bp);
+}
+
+/*
+ * merge_block - Mark the block free and let coalesce put it back in the
+ * lists.
+ */
+static void merge_block(struct arena *ar, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+
+    PUT(HDRP(bp), PACK(size, 0) | GET_PREV_ALLOC(HDRP(bp)));
+    PUT(FTRP(bp), PACK(size, 0));
+	CLR_PREV_ALLOC(NEXT_BLKP(bp));
+    coalesce(ar, bp);
+}
+
+/*
+ * quick_get - Take a block of exactly asize bytes off the arena's quick
+ * list. It is still marked allocated, so it goes out as it is.
+ */
+static void *quick_get(struct arena *ar, size_t asize)
+{
+	void *bp;
+
+	if (asize > QUICK_MAX_SIZE || (bp = ar->quick[asize / DSIZE]) == NULL)
+		return NULL;
+	ar->quick[asize / DSIZE] = BP_TO_NEXT_FREE(bp);
+	ar->quick_count--;
+	SAY2("DEBUG: quick_get: [%p] for size %u\n", bp, (unsigned int)asize);
+	return bp;
+}
+
+/*
+ * quick_consolidate - Empty the quick lists and coalesce their blocks.
+ * Neighbours still waiting on a list look allocated, so each merge only
+ * sees blocks that are truly free; those neighbours join in on their
+ * own turn.
+ */
+static void quick_consolidate(struct arena *ar)
+{
+	void *bp, *next;
+	int i;
+
+	if (ar->quick_count == 0)
+		return;
+	SAY1("DEBUG: quick_consolidate: %u blocks\n", ar->quick_count);
+	for (i = 0; i < QUICK_BINS; i++) {
+		for (bp = ar->quick[i]; bp != NULL; bp = next) {
+			next = BP_TO_NEXT_FREE(bp);
+			merge_block(ar, bp);
+		}
+		ar->quick[i] = NULL;
+	}
+	ar->quick_count = 0;
+}
+
+#if MM_STATS || MM_PROFILE
+/*
+ * block_bytes - The bytes bp takes up: its mapping from the
+ * start of the page, or its heap block with the header.
+ */
+static size_t block_bytes(void *bp)
+{
+	if (GET_OWN(bp) & MMAPPED)
+		return MMAP_LEN(bp);
+	return GET_OWN(bp) & ~(word_t)0x7;
+}
+#endif
+
+#if MM_STATS
+/*
+ * stats_register - First counter bumped by this thread: put its counters
+ * where mm_stats can find them, and arm the exit destructor so they are
+ * kept after the thread is gone.
+ */
+static struct thread_stats *stats_register(void)
+{
+	pthread_once(&tcache_once, tcache_key_init);
+	pthread_mutex_lock(&stats_lock);
+	memset(&tcache.stats, 0, sizeof(tcache.stats));
+	tcache.cache = &mm_cache;
+	tcache.next_listed = stats_threads;
+	stats_threads = &tcache;
+	tcache.listed = 1;
+	pthread_mutex_unlock(&stats_lock);
+	if (!tcache.armed) {
+		pthread_setspecific(tcache_key, &tcache);
+		tcache.armed = 1;
+	}
+	return &tcache.stats;
+}
+
+static void stats_unregister(struct tcache *tc)
+{
+	struct tcache **tp;
+
+	if (!tc->listed)
+		return;
+	pthread_mutex_lock(&stats_lock);
+	for (tp = &stats_threads; *tp != tc; tp = &(*tp)->next_listed)
+		;
+	*tp = tc->next_listed;
+	tc->listed = 0;
+	stats_add(&stats_dead, tc);
+	__atomic_add_fetch(&live_total, tc->live_pending +
+		(long)(tc->cache->fast_bytes - tc->fast_flushed), __ATOMIC_RELAXED);
+	tc->live_pending = 0;
+	tc->fast_flushed = tc->cache->fast_bytes;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * stats_sum - Add up the counters of every thread, live or gone. Other
+ * threads keep counting meanwhile, so the sum is a close snapshot.
+ */
+static void stats_sum(struct thread_stats *sum)
+{
+	struct tcache *tc;
+
+	pthread_mutex_lock(&stats_lock);
+	memcpy(sum, &stats_dead, sizeof(*sum));
+	for (tc = stats_threads; tc != NULL; tc = tc->next_listed)
+		stats_add(sum, tc);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * stats_add - Add a thread's counters to sum, along with the blocks the
+ * inline fast path took from its cache, which are only counted per bin.
+ */
+static void stats_add(struct thread_stats *sum, struct tcache *tc)
+{
+	struct thread_stats *st = &tc->stats;
+	unsigned long hits;
+	size_t i;
+
+	for (i = 0; i < MM_STATS_CLASSES; i++) {
+		sum->mallocs[i] += STAT_LOAD(st, mallocs[i]);
+		sum->frees[i] += STAT_LOAD(st, frees[i]);
+	}
+	sum->tcache_hits += STAT_LOAD(st, tcache_hits);
+	sum->tcache_misses += STAT_LOAD(st, tcache_misses);
+	sum->realloc_inplace += STAT_LOAD(st, realloc_inplace);
+	sum->realloc_copies += STAT_LOAD(st, realloc_copies);
+	sum->realloc_copied += STAT_LOAD(st, realloc_copied);
+	sum->realloc_saved += STAT_LOAD(st, realloc_saved);
+	sum->extends += STAT_LOAD(st, extends);
+	sum->fits += STAT_LOAD(st, fits);
+	sum->fit_exact += STAT_LOAD(st, fit_exact);
+	sum->fit_excess += STAT_LOAD(st, fit_excess);
+	for (i = 0; i <= FIT_SCAN; i++)
+		sum->fit_scans[i] += STAT_LOAD(st, fit_scans[i]);
+	sum->live += STAT_LOAD(st, live);
+	for (i = 0; i < TCACHE_BINS; i++)
+		if ((hits = __atomic_load_n(&tc->cache->bins[i].fast_hits, __ATOMIC_RELAXED)) != 0) {
+			sum->mallocs[STAT_CLASS(i * DSIZE)] += hits;
+			sum->tcache_hits += hits;
+		}
+	sum->live += __atomic_load_n(&tc->cache->fast_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * stats_live - Add bytes, and whatever the fast path took since the last
+ * call, to this thread's change in live bytes. Once that is LIVE_FLUSH
+ * either way it goes into live_total, and a new total may be a new peak,
+ * so peak_live is never more than LIVE_FLUSH a thread behind.
+ */
+static void stats_live(long bytes)
+{
+	unsigned long fast = mm_cache.fast_bytes;
+	long total;
+
+	tcache.live_pending += bytes + (long)(fast - tcache.fast_flushed);
+	tcache.fast_flushed = fast;
+	if (tcache.live_pending < LIVE_FLUSH && tcache.live_pending > -LIVE_FLUSH)
+		return;
+	total = __atomic_add_fetch(&live_total, tcache.live_pending, __ATOMIC_RELAXED);
+	tcache.live_pending = 0;
+	if (total > 0)
+		stats_max(&peak_live, total);
+}
+
+static void stats_max(size_t *peak, size_t value)
+{
+	size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+	while (value > old && !__atomic_compare_exchange_n(peak, &old, value, 1,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * stats_peak - Raise peak_footprint to the current footprint. Called as
+ * the heap or a mapping grows, which is when a new peak can matter.
+ */
+static void stats_peak(void)
+{
+	stats_max(&peak_footprint, mem_heapsize() +
+		__atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED));
+}
+
+#endif
+
+#if MM_STATS || MM_PROFILE
+/*
+ * note_alloc - Count a block of bytes the allocator hands out. The caller
+ * takes the size while it still holds the lock, as the neighbours of a
+ * heap block may rewrite its header once it is let go. Unless the block
+ * is to be sampled, profiling costs one decrement of the countdown.
+ */
+static void note_alloc(void *bp, size_t bytes)
+{
+#if MM_STATS
+	struct thread_stats *s;
+#endif
+
+	if (bp == NULL)
+		return;
+#if MM_STATS
+	s = STATS();
+	STAT_BUMP(s, mallocs[STAT_CLASS(bytes)], 1);
+	STAT_BUMP(s, live, (long)bytes);
+	stats_live(bytes);
+#endif
+#if MM_PROFILE
+	if ((mm_cache.countdown -= bytes) < 0)
+		prof_sample(bp, bytes);
+#endif
+}
+
+static void note_free(void *bp, size_t bytes)
+{
+#if MM_STATS
+	struct thread_stats *s = STATS();
+
+	STAT_BUMP(s, frees[STAT_CLASS(bytes)], 1);
+	STAT_BUMP(s, live, -(long)bytes);
+	stats_live(-(long)bytes);
+#endif
+#if MM_PROFILE
+	prof_free(bp);
+#endif
+}
+
+static void note_resize(void *old, size_t oldbytes, void *bp, size_t bytes)
+{
+#if MM_STATS
+	struct thread_stats *s = STATS();
+
+	STAT_BUMP(s, realloc_inplace, 1);
+	STAT_BUMP(s, live, (long)bytes - (long)oldbytes);
+	stats_live((long)bytes - (long)oldbytes);
+#endif
+#if MM_PROFILE
+	if (__atomic_load_n(&prof_filter[PROF_SLOT(old)], __ATOMIC_RELAXED) != 0)
+		prof_move(old, bp, bytes);
+#endif
+}
+#endif
+
+#if MM_PROFILE
+/*
+ * prof_sample - The countdown of this thread ran out at bp: record bp
+ * with its call stack, and draw the next countdown. A rate that has just
+ * been set or changed only draws a countdown, since the one that ran out,
+ * if it did, was not drawn for it. Also writes the dump a signal asked for.
+ */
+static void prof_sample(void *bp, size_t bytes)
+{
+	void *pc[PROF_DEPTH + 1];
+	struct prof_stack *pst;
+	struct prof_sample *ps;
+	unsigned long hash = 14695981039346656037UL;
+	unsigned int gen = __atomic_load_n(&prof_gen, __ATOMIC_ACQUIRE);
+	long rate = __atomic_load_n(&prof_rate, __ATOMIC_RELAXED);
+	int depth, i;
+
+	if (prof_busy)
+		return;
+	prof_busy = 1;
+	if (rate == 0 || rate != prof_thread_rate || gen != prof_thread_gen) {
+		prof_thread_rate = rate;
+		prof_thread_gen = gen;
+		mm_cache.countdown = rate ? prof_next(rate) : PROF_IDLE;
+		goto done;
+	}
+	mm_cache.countdown = prof_next(rate);
+
+	/* Leave out this function's own frame */
+	depth = backtrace(pc, PROF_DEPTH + 1) - 1;
+	if (depth < 0)
+		depth = 0;
+	for (i = 0; i < depth; i++)
+		hash = (hash ^ (unsigned long)pc[i+1]) * 1099511628211UL;
+
+	pthread_mutex_lock(&prof_lock);
+	for (pst = prof_stacks[hash % PROF_BUCKETS]; pst != NULL; pst = pst->next)
+		if (pst->hash == hash && pst->depth == depth &&
+			memcmp(pst->pc, pc + 1, depth * sizeof(void *)) == 0)
+			break;
+	if (pst == NULL && (pst = prof_record(sizeof(*pst))) != NULL) {
+		pst->hash = hash;
+		pst->depth = depth;
+		memcpy(pst->pc, pc + 1, depth * sizeof(void *));
+		pst->next = prof_stacks[hash % PROF_BUCKETS];
+		prof_stacks[hash % PROF_BUCKETS] = pst;
+	}
+	if ((ps = prof_spare) != NULL)
+		prof_spare = ps->next;
+	else
+		ps = prof_record(sizeof(*ps));
+	if (pst != NULL && ps != NULL) {
+		pst->live_count++;
+		pst->live_bytes += bytes;
+		pst->total_count++;
+		pst->total_bytes += bytes;
+		ps->bp = bp;
+		ps->bytes = bytes;
+		ps->stack = pst;
+		ps->next = prof_samples[PROF_BUCKET(bp)];
+		prof_samples[PROF_BUCKET(bp)] = ps;
+		__atomic_add_fetch(&prof_filter[PROF_SLOT(bp)], 1, __ATOMIC_RELAXED);
+	} else if (ps != NULL) {
+		ps->next = prof_spare;
+		prof_spare = ps;
+	}
+	pthread_mutex_unlock(&prof_lock);
+
+ done:
+	if (prof_pending) {
+		prof_pending = 0;
+		mm_profile_dump(NULL);
+	}
+	prof_busy = 0;
+}
+
+/*
+ * prof_free - Most blocks were never sampled, and their filter slot says
+ * so without taking the lock.
+ */
+static void prof_free(void *bp)
+{
+	struct prof_sample *ps;
+
+	if (__atomic_load_n(&prof_filter[PROF_SLOT(bp)], __ATOMIC_RELAXED) == 0)
+		return;
+	pthread_mutex_lock(&prof_lock);
+	if ((ps = prof_unlink(bp)) != NULL) {
+		ps->stack->live_count--;
+		ps->stack->live_bytes -= ps->bytes;
+		ps->next = prof_spare;
+		prof_spare = ps;
+	}
+	pthread_mutex_unlock(&prof_lock);
+}
+
+static void prof_move(void *old, void *bp, size_t bytes)
+{
+	struct prof_sample *ps;
+
+	pthread_mutex_lock(&prof_lock);
+	if ((ps = prof_unlink(old)) != NULL) {
+		ps->stack->live_bytes += bytes - ps->bytes;
+		ps->stack->total_bytes += bytes > ps->bytes ? bytes - ps->bytes : 0;
+		ps->bp = bp;
+		ps->bytes = bytes;
+		ps->next = prof_samples[PROF_BUCKET(bp)];
+		prof_samples[PROF_BUCKET(bp)] = ps;
+		__atomic_add_fetch(&prof_filter[PROF_SLOT(bp)], 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&prof_lock);
+}
+
+static struct prof_sample *prof_unlink(void *bp)
+{
+	struct prof_sample **pp, *ps;
+
+	for (pp = &prof_samples[PROF_BUCKET(bp)]; (ps = *pp) != NULL; pp = &ps->next)
+		if (ps->bp == bp) {
+			*pp = ps->next;
+			__atomic_sub_fetch(&prof_filter[PROF_SLOT(bp)], 1, __ATOMIC_RELAXED);
+			return ps;
+		}
+	return NULL;
+}
+
+/*
+ * prof_record - Carve profile records from mappings of their own, so the
+ * profiler neither calls into the allocator nor shows in mm_footprint.
+ */
+static void *prof_record(size_t size)
+{
+	void *p;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (prof_pool_end - prof_pool < (long)size) {
+		p = mmap(NULL, PROF_CHUNK, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		prof_pool = p;
+		prof_pool_end = prof_pool + PROF_CHUNK;
+	}
+	p = prof_pool;
+	prof_pool += size;
+	return p;
+}
+
+/*
+ * prof_next - Draw from an exponential distribution with mean rate, as
+ * -ln(u) * rate for u uniform in (0,1]. log2 of u comes from the exponent
+ * bits of a double plus a quadratic fit of the mantissa, which is close
+ * enough for sampling and needs no libm.
+ */
+static long prof_next(long rate)
+{
+	union { double d; unsigned long u; } v;
+	double log2u;
+	long next;
+
+	if (prof_seed == 0)
+		prof_seed = (unsigned long)&prof_seed * 0x9e3779b97f4a7c15UL | 1;
+	prof_seed ^= prof_seed << 13;
+	prof_seed ^= prof_seed >> 7;
+	prof_seed ^= prof_seed << 17;
+
+	/* 26 random bits, plus one so u is never zero */
+	v.d = (double)((prof_seed >> 38) + 1);
+	log2u = (double)(long)((v.u >> 52) & 0x7ff) - 1023 - 26;
+	v.u = (v.u & ((1UL << 52) - 1)) | (1023UL << 52);
+	log2u += (v.d - 1) * (1.3466 - 0.3466 * (v.d - 1));
+	next = (long)(-log2u * 0.6931471805599453 * rate);
+	return next > 0 ? next : 1;
+}
+
+static void prof_signal(int signo)
+{
+	(void)signo;
+	prof_pending = 1;
+}
+
+/*
+ * prof_print - Append a formatted line to the dump buffer, writing the
+ * buffer out to fd first if the line might not fit.
+ */
+static int prof_print(int fd, char *buf, size_t *len, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+static int prof_print(int fd, char *buf, size_t *len, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (*len > 3072) {
+		if (write(fd, buf, *len) != (ssize_t)*len)
+			return -1;
+		*len = 0;
+	}
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *len, 4096 - *len, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		*len += MIN((size_t)n, 4095 - *len);
+	return 0;
+}
+#endif
 
-    /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
-    if(size < oldsize) oldsize = size;
-    memcpy(newptr, ptr, oldsize);
+/*
+ * mm_profile_dump - Write the sampled heap to path, or to mm.<pid>.<n>.heap
+ * if path is NULL, in the legacy heap profile format that pprof reads.
+ * Each stack gets a line "live: bytes [total: bytes] @ pc...", and pprof
+ * scales the samples back up using the rate in the first line. Returns 0,
+ * or -1 if the file could not be written.
+ */
+int mm_profile_dump(const char *path)
+{
+#if MM_PROFILE
+	char name[64], buf[4096];
+	struct prof_stack *pst;
+	unsigned long live_count = 0, total_count = 0;
+	size_t live_bytes = 0, total_bytes = 0, len = 0;
+	ssize_t n;
+	int fd, maps, i, j, err = 0;
+
+	if (path == NULL) {
+		snprintf(name, sizeof(name), "mm.%d.%u.heap", (int)getpid(),
+			__atomic_fetch_add(&prof_dumps, 1, __ATOMIC_RELAXED));
+		path = name;
+	}
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
 
-    /* Free the old block. */
-    mm_free(ptr);
+	/* Nothing here allocates, so threads that sample meanwhile just wait */
+	pthread_mutex_lock(&prof_lock);
+	for (i = 0; i < PROF_BUCKETS; i++)
+		for (pst = prof_stacks[i]; pst != NULL; pst = pst->next) {
+			live_count += pst->live_count;
+			live_bytes += pst->live_bytes;
+			total_count += pst->total_count;
+			total_bytes += pst->total_bytes;
+		}
+	err |= prof_print(fd, buf, &len, "heap profile: %6lu: %8lu [%6lu: %8lu] @ heap_v2/%ld\n",
+		live_count, (unsigned long)live_bytes, total_count,
+		(unsigned long)total_bytes, __atomic_load_n(&prof_rate, __ATOMIC_RELAXED));
+	for (i = 0; i < PROF_BUCKETS; i++)
+		for (pst = prof_stacks[i]; pst != NULL; pst = pst->next) {
+			err |= prof_print(fd, buf, &len, "%6lu: %8lu [%6lu: %8lu] @",
+				pst->live_count, (unsigned long)pst->live_bytes,
+				pst->total_count, (unsigned long)pst->total_bytes);
+			for (j = 0; j < pst->depth; j++)
+				err |= prof_print(fd, buf, &len, " %p", pst->pc[j]);
+			err |= prof_print(fd, buf, &len, "\n");
+		}
+	pthread_mutex_unlock(&prof_lock);
+
+	/* pprof maps the addresses to symbols with the process's mappings */
+	err |= prof_print(fd, buf, &len, "\nMAPPED_LIBRARIES:\n");
+	if (len > 0 && write(fd, buf, len) != (ssize_t)len)
+		err = -1;
+	if ((maps = open("/proc/self/maps", O_RDONLY)) >= 0) {
+		while ((n = read(maps, buf, sizeof(buf))) > 0)
+			if (write(fd, buf, n) != n)
+				err = -1;
+		close(maps);
+	}
+	if (close(fd) < 0)
+		err = -1;
+	return err ? -1 : 0;
+#else
+	(void)path;
+	return -1;
+#endif
+}
 
-    return newptr;
+/*
+ * zero_seam - lo and hi are free blocks about to merge, lo first. Clear
+ * the words that are metadata now but will be payload of the merged
+ * block: lo's footer, and hi's header and links. hi's footer is left
+ * alone. Callers must have taken hi off its list already, and must be
+ * done with the sizes in both headers.
+ */
+static void zero_seam(void *lo, void *hi)
+{
+	PUT(FTRP(lo), 0);
+	memset(HDRP(hi), 0, MIN(5*WSIZE, GET_SIZE(HDRP(hi)) - WSIZE));
 }
 
-/* 
- * mm_check - based from book code. Perform various checks on the heap state.
- * Force program termination upon error and print helpful information.
- * 
- * Checks performed:
- *					* Make sure two adjacent blocks are not free
- *					* Verify prologue and epilgue headers
- *					* Check for free blocks not in the free list
- *					* Check for llocated blocks in the free list
- *		
+/*
+ * remote_free - Push bp on the arena's remote stack. Any thread may push,
+ * but only a lock holder takes the stack, and it takes all of it at once,
+ * so a plain compare-and-swap loop is safe from ABA.
  */
-void mm_check(int verbose)
-{ 
-    char *bp = heap_listp;
+static void remote_free(struct arena *ar, void *bp)
+{
+	void *head;
 
-    if (verbose)
-	SAY1("DEBUG: mm_check: Heap (%p):\n", heap_listp);
+	do {
+		head = __atomic_load_n(&ar->remote_frees, __ATOMIC_RELAXED);
+		*(void **)bp = head;
+	} while (!__atomic_compare_exchange_n(&ar->remote_frees, &head, bp, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-    if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
-	{
-		SAY0("DEBUG: mm_check: ERROR: Bad prologue header\n");
-		Assert(0==1);
-	}
-    checkblock(heap_listp);
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (verbose) 
-			printblock(bp);
-		checkblock(bp);
-		
-		/* Check if two blocks next to each other are free */
-		if(!(GET_ALLOC(HDRP(bp))) && !(GET_ALLOC(HDRP(bp+GET_SIZE(HDRP(bp))))))
-			{
-				SAY0("DEBUG: mm_check: Double free blocks:\n");
-				printblock(bp);
-				printblock(bp+GET_SIZE(HDRP(bp)));
-				Assert(0==1);
-			}
-    }
-    if (verbose)
-	printblock(bp);
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
-	SAY0("DEBUG: mm_check: ERROR: Bad epilogue header\n");
-	
-	/* Loop through each list to check its blocks */
-	int i=0;
-	for (i=0; i<9; i++)
-	{
-		int index = get_index(GET_SIZE(HDRP(bp)));
-		void *fp = lists[index];
-		for (fp=lists[index]; fp != NULL; fp = BP_TO_NEXT_FREE(fp)) {
-		
-			/* Check for free blocks not in the list and allocated blocks in the list */
-			if(GET_ALLOC(HDRP(fp)) == list_search(fp))
-			{
-				if (GET_ALLOC(HDRP(fp)) && list_search(fp))
-				{
-					SAY1("ERROR: mm_check: allocated block %p in list\n", fp);
-					SAY2("DEBUG: mm_check: allocated block in free list. GET_ALLOC is %i, list_search is %i\n", (GET_ALLOC(HDRP(fp))), list_search(fp));
-					printblock(fp);
-					Assert(!GET_ALLOC(HDRP(fp)));
-				}
-				else
-				{
-					SAY1("ERROR: mm_check: free block %p not in list\n", fp);
-					SAY2("DEBUG: mm_check: GET_ALLOC is %i, list_search is %i\n", (GET_ALLOC(HDRP(fp))), list_search(fp));
-					Assert(0==1);
-				}
-			}
-		}
+/*
+ * remote_drain - Take the arena's whole remote stack and free each block
+ * on it for real.
+ */
+static void remote_drain(struct arena *ar)
+{
+	void *bp, *next;
+
+	if (__atomic_load_n(&ar->remote_frees, __ATOMIC_RELAXED) == NULL)
+		return;
+	bp = __atomic_exchange_n(&ar->remote_frees, NULL, __ATOMIC_ACQUIRE);
+	for (; bp != NULL; bp = next) {
+		next = *(void **)bp;
+		SAY1("DEBUG: remote_drain: freeing [%p]\n", bp);
+		ar->freed_since_trim += GET_SIZE(HDRP(bp));
+		free_block(ar, bp);
 	}
 }
 
-/* 
- * extend_heap - Extend heap with free block and return its block pointer
+/*
+ * tcache_get - Pop a cached block from the bin for asize. Blocks in a
+ * bin are all exactly the bin's size and are still marked allocated,
+ * so they can be returned without touching the header.
  */
- 
-static void *extend_heap(size_t words)
+static void *tcache_get(size_t asize)
 {
-	SAY0("DEBUG: extend_heap: entering\n");
-    char *bp;
-    size_t size;
-	
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)  
-		return NULL;
-	SAY1("DEBUG: extend_heap: mem_sbrk(%u) has returned successfully\n", size);
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
-    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */   
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+	struct mm_cache_bin *bin = &mm_cache.bins[asize / DSIZE];
+	void *bp = bin->head;
 
-	SAY0("DEBUG: extend_heap: free block initialized; epilogue set\n");
-	SAY0("DEBUG: extend_heap: calling coalesce\n");
-    /* Coalesce if the previous block was free */
-	heap_lastp = bp;
-	SAY1("DEBUG: extend_heap: calling list_add %p\n", bp);
-	SAY1("DEBUG: extend_heap: calling coalesce(%p)\n", bp);
-	bp = coalesce(bp);
-	
-	SAY("DEBUG: extend_heap: done. calling PLIST()\n");
-	//PLIST()
-	SAY("DEBUG: extend_heap: done. calling CHEAP()\n");
-	CHEAP()
-	SAY1("DEBUG: extend_heap: done. returning [%p]\n", bp);
+	if (bp == NULL || mm_cache.gen != mm_heap_gen)
+		return NULL;
+	bin->head = TC_NEXT(bp);
+	bin->count--;
+	SAY2("DEBUG: tcache_get: [%p] for size %u\n", bp, (unsigned int)asize);
 	return bp;
 }
 
+/*
+ * tcache_put - Push a block being freed onto its bin. A full bin first
+ * sends its oldest TCACHE_FLUSH blocks back to the free lists, so one
+ * mm_free in TCACHE_FLUSH pays for list traffic instead of every one.
+ */
+static int tcache_put(void *bp, size_t size)
+{
+	struct mm_cache_bin *bin;
+
+	if (mm_cache.gen != mm_heap_gen) {
+		/* Blocks cached before the last mm_init are gone with that heap */
+		memset(mm_cache.bins, 0, sizeof(mm_cache.bins));
+		mm_cache.gen = mm_heap_gen;
+	}
+	if (!tcache.armed) {
+		tcache.cache = &mm_cache;
+		pthread_setspecific(tcache_key, &tcache);
+		tcache.armed = 1;
+	}
+#if MM_STATS
+	/* The fast path counts what it takes in the bins, for stats_add */
+	if (!tcache.listed)
+		stats_register();
+#endif
+
+	bin = &mm_cache.bins[size / DSIZE];
+	if (bin->count >= TCACHE_FILL)
+		tcache_flush(bin, TCACHE_FLUSH);
+	TC_NEXT(bp) = bin->head;
+	bin->head = bp;
+	bin->count++;
+	return 1;
+}
+
+/*
+ * tcache_flush - Free the oldest n blocks of a bin for real. Blocks from
+ * this thread's arena are put back in its lists under one lock; blocks
+ * from other arenas go on their remote stacks.
+ */
+static void tcache_flush(struct mm_cache_bin *bin, unsigned int n)
+{
+	void *bp = bin->head;
+	void *next;
+	unsigned int keep;
+	struct arena *ar = NULL, *owner;
+
+	if (n >= bin->count) {
+		n = bin->count;
+		bin->head = NULL;
+	}
+	else {
+		/* The newest blocks are at the head; skip past the ones we keep */
+		for (keep = bin->count - n; keep > 1; keep--)
+			bp = TC_NEXT(bp);
+		next = TC_NEXT(bp);
+		TC_NEXT(bp) = NULL;
+		bp = next;
+	}
+	bin->count -= n;
+
+	SAY1("DEBUG: tcache_flush: returning %u blocks\n", n);
+	for (; bp != NULL; bp = next) {
+		next = TC_NEXT(bp);
+		if ((owner = arena_of(bp)) != thread_arena) {
+			remote_free(owner, bp);
+			continue;
+		}
+		if (ar == NULL) {
+			ar = owner;
+			pthread_mutex_lock(&ar->lock);
+			remote_drain(ar);
+		}
+		free_block(ar, bp);
+	}
+	if (ar != NULL)
+		pthread_mutex_unlock(&ar->lock);
+}
+
+static void tcache_key_init(void)
+{
+	pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/*
+ * tcache_exit - A thread is going away; give its cached blocks back so
+ * they are not lost with the thread.
+ */
+static void tcache_exit(void *arg)
+{
+	struct tcache *tc = arg;
+	int i;
+
+#if MM_STATS
+	stats_unregister(tc);
+#endif
+	if (tc->cache == NULL || tc->cache->gen != mm_heap_gen)
+		return;
+	for (i = 0; i < TCACHE_BINS; i++)
+		tcache_flush(&tc->cache->bins[i], tc->cache->bins[i].count);
+}
 
 
 
 /* Add to list, return 1 if success and 0 if fail
 	
-	Updates block pointers and the following globals:
-	static void* tree_p;		 Point to first free list item 
-	static void* free_lastp;	 Point to last free list item
+	Pushes the block on the front of the list for its size and marks the
+	list non-empty in both bitmaps.
 
  */
-static int list_add(void* bp)
+static int list_add(struct arena *ar, void* bp)
 {
-	int index = get_index(GET_SIZE(HDRP(bp)));
-	void* current_list = lists[index];
-	SAY("DEBUG: list_add: State of list before list_add:\n");
-	PLIST()
+	int fl, sl;
+	get_index(GET_SIZE(HDRP(bp)), &fl, &sl);
+	void* current_list = ar->lists[fl][sl];
 	SAY2("DEBUG: list_add: adding %p, alloc: %i\n", bp, GET_ALLOC(HDRP(bp)));
 	Assert(!GET_ALLOC(HDRP(bp)));
 	
-	/* If list is empty */
-	if (current_list == NULL)
-	{
-		SAY0("DEBUG: list_add: nothing in list yet\n");
-		/* Create list */
-		lists[index] = bp;
-		if (free_lastp == NULL || bp > free_lastp)
-		{
-			free_lastp = bp; /* last free block in heap */
-		}
-		/* If the list is empty, the block's next and previous pointers should be NULL */
-		
-		BP_TO_NEXT_FREE(bp) = NULL; 
-		BP_TO_PREV_FREE(bp) = NULL;
-		SAY3("DEBUG: list_add: bp: %p BP_TO_PREV_FREE(bp):%p BP_TO_NEXT_FREE(bp): %p\n", bp, BP_TO_PREV_FREE(bp), BP_TO_NEXT_FREE(bp));
-		SAY("DEBUG: list_add: State of list after list_add:\n");
-		//PLIST()
-		return 1;
-	}
-	else
-	{
-		/* list wasn't empty; inserting into the list, sorted from size low -> high */
-		
-		SAY0("DEBUG: list_add: list wasn't empty, inserting at beginning\n");
-		SAY2("DEBUG: list_add: current_list: [%p], bp: [%p] \n", current_list, bp);
-		void* lp = current_list; /* hold last pointer, loop pointer */
-		
-		while(GET_SIZE(HDRP(bp)) > GET_SIZE(HDRP(lp)) && BP_TO_NEXT_FREE(lp) != NULL)
-		{
-			lp = BP_TO_NEXT_FREE(lp);
-		}
-		
-		
-		/* if between two blocks */
-		if (lp != current_list && lp != free_lastp)
-		{	
-			SAY("DEBUG: list_add: add between two blocks\n");
-			void* new_prev = BP_TO_PREV_FREE(lp);
-			BP_TO_NEXT_FREE(new_prev) = bp;
-			BP_TO_NEXT_FREE(bp) = lp;
-			BP_TO_PREV_FREE(bp) = new_prev;
-			BP_TO_PREV_FREE(lp) = bp;
-		}
-		/* If at end of list */
-		else if(lp == free_lastp)
-		{
-			SAY("DEBUG: list_add: add to list end\n");
-			BP_TO_NEXT_FREE(lp) = bp;
-			BP_TO_PREV_FREE(bp) = lp;
-			BP_TO_NEXT_FREE(bp) = NULL;
-			if (free_lastp < bp)
-			{
-				free_lastp = bp;
-			}
-		}
-		/* if at beginning of list */
-		else if(lp == current_list)
-		{
-			SAY("DEBUG: list_add: add to list beginning\n");
-			BP_TO_PREV_FREE(bp) = NULL;
-			BP_TO_NEXT_FREE(bp) = lp;
-			BP_TO_PREV_FREE(lp) = bp;
-			lists[index] = bp;
-		}
-		
-		SAY3("DEBUG: list_add: bp: %p BP_TO_PREV_FREE(bp):%p BP_TO_NEXT_FREE(bp): %p\n", bp, BP_TO_PREV_FREE(bp), BP_TO_NEXT_FREE(bp));
-		SAY("DEBUG: list_add: State of list after list_add:\n");
-		//PLIST()
-		return 1;
-	}
-return 0;
+	SET_NEXT_FREE(bp, current_list);
+	SET_PREV_FREE(bp, NULL);
+	if (current_list != NULL)
+		SET_PREV_FREE(current_list, bp);
+	ar->lists[fl][sl] = bp;
+	ar->fl_bitmap |= 1U << fl;
+	ar->sl_bitmap[fl] |= 1U << sl;
+	if (GET_SIZE(HDRP(bp)) >= LARGE_BLOCK && !(GET(HDRP(bp)) & ZEROED))
+		ar->dirty_large++;
+	
+	SAY3("DEBUG: list_add: bp: %p BP_TO_PREV_FREE(bp):%p BP_TO_NEXT_FREE(bp): %p\n", bp, BP_TO_PREV_FREE(bp), BP_TO_NEXT_FREE(bp));
+	return 1;
 }
 
 
@@ -622,216 +3285,184 @@ return 0;
 *
  */
 
-static int list_rm(void* bp)
-{	/* If list is empty */
-	int index = get_index(GET_SIZE(HDRP(bp)));
-	void* current_list = lists[index];
-	SAY1("DEBUG: list_rm: this should equal true: %i\n", current_list == bp);
-	SAY2("DEBUG: list_rm: current_list:[%p] bp: [%p]\n", current_list, bp);
-	SAY1("DEBUG: list_rm: removing %p\n", bp);
-	if (current_list == NULL)
-	{
-		SAY1("DEBUG: list_rm: current_list was null, returning fail %p\n", current_list);
-		return 0;
-	}
+static int list_rm(struct arena *ar, void* bp)
+{
+	int fl, sl;
 	if(GET_ALLOC(HDRP(bp))) {
 		SAY1("DEBUG: list_rm: Someone's trying to remove an allocated block from the free list %p\n", bp);
-		return 1; 
+		return 0; 
 	}
+	get_index(GET_SIZE(HDRP(bp)), &fl, &sl);
+	void* bp_of_prev = BP_TO_PREV_FREE(bp);
+	void* bp_of_next = BP_TO_NEXT_FREE(bp);
+	SAY3("DEBUG: list_rm: %p %p %p\n", bp, bp_of_prev, bp_of_next);
 	
-	SAY3("DEBUG: list_rm: current_list: [%p] bp: [%p] free_lastp: [%p]\n", current_list, bp, free_lastp);
-	if (current_list == bp && BP_TO_NEXT_FREE(bp) == NULL) 
-	{ /* it's the only one in the list */
-		lists[index] = NULL;
-		if (free_lastp != NULL && bp > free_lastp)
+	if (bp_of_prev == NULL)
+	{
+		/* Only the first block of a list has no previous block */
+		if (ar->lists[fl][sl] != bp)
 		{
-			free_lastp = NULL;
+			SAY1("DEBUG: list_rm: %p is not in its list\n", bp);
+			return 0;
 		}
-		return 1;
-	}
-	SAY("DEBUG: list_rm: not the only one in the list\n");
-	/* else if it's first one in list	*/
-	if (current_list == bp)
-	{
-		void* bp_of_next = BP_TO_NEXT_FREE(bp);
-		SAY2("DEBUG: list_rm: %p comes out to %p\n", bp, PREV_FREE(bp_of_next));
-		lists[index] = bp_of_next;
-		BP_TO_PREV_FREE(bp_of_next) = NULL;
-		return 1;
-	}
-	/* else if it's the last one in the list */
-	if (BP_TO_NEXT_FREE(bp) == NULL)
-	{
-		SAY("DEBUG: list_rm: It's last in list\n");
-		void* bp_of_prev = BP_TO_PREV_FREE(bp);
-		if (bp_of_prev > free_lastp)
+		ar->lists[fl][sl] = bp_of_next;
+		if (bp_of_next == NULL)
 		{
-			free_lastp = bp_of_prev;
+			/* The list is now empty */
+			ar->sl_bitmap[fl] &= ~(1U << sl);
+			if (ar->sl_bitmap[fl] == 0)
+				ar->fl_bitmap &= ~(1U << fl);
 		}
-		SAY2("DEBUG: list_rm: bp_of_prev:%p BP_TO_PREV_FREE:%p\n",bp_of_prev,BP_TO_PREV_FREE(bp));
-		BP_TO_NEXT_FREE(BP_TO_PREV_FREE(bp)) = NULL;
-		return 1;
 	}
-	/* else it's in the middle */
- 	SAY3("DEBUG: list_rm: It's in the middle [%p], next: %p prev:%p\n", bp, BP_TO_NEXT_FREE(bp), BP_TO_PREV_FREE(bp));
-	void* bp_of_prev = BP_TO_PREV_FREE(bp);
-	void* bp_of_next = BP_TO_NEXT_FREE(bp);
-	SAY3("DEBUG: list_rm: %p %p %p\n", bp, bp_of_prev, bp_of_next);
-	BP_TO_PREV_FREE(bp_of_next) = BP_TO_PREV_FREE(bp);
-	SAY1("DEBUG: list_rm: BP_TO_NEXT_FREE(bp) is %p\n", BP_TO_NEXT_FREE(bp));
-	SAY1("DEBUG: list_rm: bp_of_prev is %p\n",bp_of_prev );
-	BP_TO_NEXT_FREE(bp_of_prev) = BP_TO_NEXT_FREE(bp);
+	else
+		SET_NEXT_FREE(bp_of_prev, bp_of_next);
 	
-
-	return 0;
+	if (bp_of_next != NULL)
+		SET_PREV_FREE(bp_of_next, bp_of_prev);
+	if (GET_SIZE(HDRP(bp)) >= LARGE_BLOCK && !(GET(HDRP(bp)) & ZEROED) && ar->dirty_large > 0)
+		ar->dirty_large--;
+	return 1;
 }
 /* 
  * place - Place block of asize bytes at start of free block bp 
  *         and split if remainder would be at least minimum block size
  */
  
-static void place(void *bp, size_t asize)
+static void place(struct arena *ar, void *bp, size_t asize)
 
 {
     size_t csize = GET_SIZE(HDRP(bp));
 	SAY1("DEBUG: placing %p\n", bp);
 	SAY2("DEBUG: place: asize: %u csize: %u\n", asize, csize);
 	
-    if ((csize - asize) >= (2*DSIZE)) {
-	PUT(HDRP(bp), PACK(asize, 1));
-	PUT(FTRP(bp), PACK(asize, 1));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	/* An allocated block's bit 2 is MMAPPED, never set in the heap */
+	word_t zero = GET(HDRP(bp)) & ZEROED;
+
+    if ((csize - asize) >= MIN_BLOCK) {
+	PUT(HDRP(bp), PACK(asize, 1) | prev_alloc);
 	SAY2("DEBUG: place just made block [%p], size: %i\n", bp, GET_SIZE(HDRP(bp)));
 	bp = NEXT_BLKP(bp);
-	PUT(HDRP(bp), PACK(csize-asize, 0));
+	/* The remainder is as zero as the block it was cut from */
+	PUT(HDRP(bp), PACK(csize-asize, 0) | PREV_ALLOC | zero);
 	PUT(FTRP(bp), PACK(csize-asize, 0));
+	CLR_PREV_ALLOC(NEXT_BLKP(bp));
 	SAY2("DEBUG: place just split off block [%p], size: %i\n", bp, GET_SIZE(HDRP(bp)));
 	
 	/* Add this block slice to the free list */
-	/* Update heap_lastp to point to last block after extend_heap call */
-	if (bp > (void *)heap_lastp)
-		{
-			heap_lastp = bp;
-			SAY1("DEBUG: place: calling coalesce on %p\n", bp);
-		}
-	coalesce(bp);
+	SAY1("DEBUG: place: calling coalesce on %p\n", bp);
+	coalesce(ar, bp);
 	}
     else { 
-	PUT(HDRP(bp), PACK(csize, 1));
-	PUT(FTRP(bp), PACK(csize, 1));
+	PUT(HDRP(bp), PACK(csize, 1) | prev_alloc);
+	SET_PREV_ALLOC(NEXT_BLKP(bp));
     }
 }
 
 
 /* 
  * find_fit - Find a fit for a block with asize bytes 
- * Uses best fit strategy. 
+ * Uses good fit strategy: the first block of the list asize belongs in is
+ * taken if it is big enough, otherwise the first block of the next list
+ * up that is non-empty, whose blocks all fit. Constant time.
+ * A request no list above can serve looks a few blocks further down its
+ * own list.
  */
  
- /* TODO: make this get fit from free list */
-static void *find_fit(size_t asize, int index)
+static void *find_fit(struct arena *ar, size_t asize)
 {
-	void* current_list = lists[index];
-	
-	/* Best fit search */
-	
-	/*CASE: list is empty, so no fit, DUH */
-	if(current_list == NULL) 
-	{
-		SAY2("DEBUG: find_fit: List is empty, calling find_fit(%u, %i)\n", asize, index+1);
-		
-		if (index<7) return find_fit(asize, ++index);
-		else return NULL;
-	}	
+	void *bp = search_fit(ar, asize);
 
-	/* begin search at the beginning of the list */
-    void *bp = current_list;
-	
-	void *best = NULL; /* return NULL if none found */
-	size_t best_size = (size_t)-1;	/* Gets the max size of size_t */
-	size_t curr_size;	/* Gets the max size of size_t */
-	SAY1("DEBUG: find_fit: bp is %p\n", bp);
-	while(bp != NULL)
-	{
-		curr_size = GET_SIZE(HDRP(bp));
-		
-		SAY("DEBUG: find_fit: List is not empty\n");
-		if (asize == curr_size)
-		{
-			SAY("DEBUG: find_fit: equal sizes, this is the best fit\n");
-			return bp;		/* If they are equal, this fit is the best */
-		}
-		else if(asize < curr_size && curr_size < best_size)
-		{
-			best_size = curr_size;
-			best = bp;
-		}
-		bp = BP_TO_NEXT_FREE(bp);
-	}
-	if(best_size == ((size_t)-1))
-	{
-		SAY("DEBUG: find_fit: the best_size was not so great \n");
-		if (index<7) 
-		{
-			SAY2("DEBUG: find_fit: didn't find fit with index %i for size %u\n", index, asize);
-			best = find_fit(asize, ++index);
-		}
-		else return NULL;
+	/* Deferred blocks may merge into a fit; try once more after that */
+	if (bp == NULL && ar->quick_count > 0) {
+		quick_consolidate(ar);
+		bp = search_fit(ar, asize);
 	}
-	
-	SAY2("DEBUG: find_fit: after loop, %p is best, size is: %i\n", best, best_size);
-	return best;
+	return bp;
 }
 
-/* 
- * list_search:
- * 
- * Determine if a block is in the free list. This is O(n) running time, so 
- * it is not called in a normal malloc/free/realloc session. 
- *
- * Used for debugging
- *
+/*
+ * search_fit - Find a free block of at least asize bytes in the lists,
+ * or return NULL.
  */
-static int list_search(void* bp)
+static void *search_fit(struct arena *ar, size_t asize)
 {
-	int index = get_index(GET_SIZE(HDRP(bp)));
-	void* current_list = lists[index];
-	//SAY0("DEBUG: list_search: entering\n");
-	
-	/* Check if list is uninitialized */
-	if (current_list == NULL) 
-	{
-		SAY("Not in list. Uninitialized. \n");
-		Assert(0==1);
-		return 0; /* Not in the list */
+	int fl, sl, own_fl, own_sl;
+	unsigned int map;
+	void *bp;
+
+	/* Cheap exact-list try first; it keeps small requests best fit */
+	get_index(asize, &own_fl, &own_sl);
+	if (own_fl >= FL_COUNT)
+		return NULL;
+	bp = ar->lists[own_fl][own_sl];
+	if (bp != NULL && GET_SIZE(HDRP(bp)) >= asize) {
+		STAT_INC(fits);
+		STAT_INC(fit_exact);
+		STAT_ADD(fit_excess, GET_SIZE(HDRP(bp)) - asize);
+		return bp;
 	}
-	void * lp = current_list;
-	//SAY2("DEBUG: list_search: lp is %p, bp is %p \n", lp, bp);
-	
-	if (bp == NULL)
+
+	get_fit_index(asize, &fl, &sl);
+	if (fl >= FL_COUNT)
+		goto own;
+
+	/* Any non-empty list at or above sl at this level? */
+	map = ar->sl_bitmap[fl] & (~0U << sl);
+	if (map == 0)
 	{
-		SAY1("DEBUG: list_search: lp was null %p \n", lp);
-		Assert(0==1);
-		return 0; /* not in the list */
+		/* No; use the smallest non-empty list of a higher level */
+		map = (fl + 1 < FL_COUNT) ? ar->fl_bitmap & (~0U << (fl + 1)) : 0;
+		if (map == 0)
+		{
+			SAY1("DEBUG: find_fit: no list fit for %u\n", (unsigned int)asize);
+			goto own;
+		}
+		fl = __builtin_ctz(map);
+		map = ar->sl_bitmap[fl];
 	}
-	
-	if (bp == lp) { 		/* We have found a match */
-		//SAY0("DEBUG: list_search: we have found a match | returning\n")
-		return 1;
+	sl = __builtin_ctz(map);
+	SAY3("DEBUG: find_fit: using list %d/%d for %u\n", fl, sl, (unsigned int)asize);
+	bp = ar->lists[fl][sl];
+	STAT_INC(fits);
+	STAT_ADD(fit_excess, GET_SIZE(HDRP(bp)) - asize);
+	return bp;
+
+own:
+	/* Nothing above; a fit may still be further down asize's own list,
+	   which can be wide, and is the only list a size in the last class
+	   of an mm_size_classes table has */
+	if ((bp = scan_list(ar, own_fl, own_sl, asize)) != NULL) {
+		STAT_INC(fits);
+		STAT_INC(fit_exact);
+		STAT_ADD(fit_excess, GET_SIZE(HDRP(bp)) - asize);
+		return bp;
 	}
-	
-	//SAY1("DEBUG: loop: lpget is %p \n", NEXT_FREE(lp));
-	while(BP_TO_NEXT_FREE(lp) != NULL)
-	{
-		lp = BP_TO_NEXT_FREE(lp);
-		//SAY1("DEBUG: list_search: looping, lp is %p \n", lp);
-		if (bp == lp) { 	/* We have found a match */
-			return 1;
+	return NULL;
+}
+
+/*
+ * scan_list - The smallest block of at least asize bytes among the first
+ * FIT_SCAN of list fl/sl, or NULL. The walk stops early on an exact fit.
+ * mm_stats counts the walks by the number of blocks they looked at.
+ */
+static void *scan_list(struct arena *ar, int fl, int sl, size_t asize)
+{
+	void *bp, *fit = NULL;
+	int n;
+
+	for (bp = ar->lists[fl][sl], n = 0; bp != NULL && n < FIT_SCAN; bp = BP_TO_NEXT_FREE(bp)) {
+		n++;
+		if (GET_SIZE(HDRP(bp)) >= asize &&
+			(fit == NULL || GET_SIZE(HDRP(bp)) < GET_SIZE(HDRP(fit)))) {
+			fit = bp;
+			if (GET_SIZE(HDRP(bp)) == asize)
+				break;
 		}
 	}
-		SAY("DEBUG: list_search: did not find matching blocks in loop.\n");
-		Assert(0==1);
-	return 0;
-	}
+	STAT_INC(fit_scans[n]);
+	return fit;
+}
 
 /*
  * printlist
@@ -842,29 +3473,30 @@ static int list_search(void* bp)
 static void printlists()
 {	
 	SAY0("DEBUG: ============= PRINTING ALL LISTS =============\n");
-	int index = 0;
-	for (index = 0; index < 9; index++)
-		{
-			printlist(index);
-		}
+	int i, fl, sl;
+	for (i = 0; i < MAX_ARENAS; i++)
+		for (fl = 0; fl < FL_COUNT; fl++)
+			for (sl = 0; sl < SL_COUNT; sl++)
+				if (arenas[i].lists[fl][sl] != NULL)
+					printlist(&arenas[i], fl, sl);
 	SAY0("DEBUG: ================ END ALL LISTS ================\n");	
 }
-	static void printlist(int index)
+	static void printlist(struct arena *ar, int fl, int sl)
 {
-	void* block = lists[index];
+	void* block;
 
-	SAY1("DEBUG: ------------- Printing Free List %d -------------\n", index);
+	SAY3("DEBUG: ------------- Printing Free List %d/%d of arena %d -------------\n", fl, sl, ar->id);
 
-	SAY2("DEBUG: block: [%p] free_lastp: [%p]\n", block, free_lastp);
-	for (block = lists[index]; block != NULL; block = BP_TO_NEXT_FREE(block))
+	for (block = ar->lists[fl][sl]; block != NULL; block = BP_TO_NEXT_FREE(block))
 		{
 			printblock(block);
 		}
-	SAY1("DEBUG: ------------- End Free List Print %d ------------\n", index);
+	SAY2("DEBUG: ------------- End Free List Print %d/%d ------------\n", fl, sl);
 }
 
 
 
+
 static void printblock(void *bp) 
 {
     size_t hsize, halloc, fsize, falloc;
@@ -872,8 +3504,9 @@ static void printblock(void *bp)
 	void* prev;
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));  
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp)); 
+    /* Allocated blocks have no footer */
+    fsize = halloc ? 0 : GET_SIZE(FTRP(bp));
+    falloc = halloc ? 0 : GET_ALLOC(FTRP(bp)); 
 	next = BP_TO_NEXT_FREE(bp);
 	prev = BP_TO_PREV_FREE(bp);
 
@@ -891,62 +3524,119 @@ static void printblock(void *bp)
 
 /*
  * Check the integrity of a given heap block. Helper method for mm_check
- *
+ * and mm_check_step. A block whose size would take the walk outside the
+ * arena ends the walk: returns -1. Otherwise returns the problems found.
  */
 
-static void checkblock(void *bp) 
+static int checkblock(struct arena *ar, void *bp) 
 {
-    if ((size_t)bp % 8)
+	size_t size = GET_SIZE(HDRP(bp));
+	char *next = (char *)bp + size;
+	int errors = 0;
+
+    if ((size_t)bp % DSIZE || size < DSIZE || size % DSIZE || next > ar->heap_end)
+	{
+		printf("Error: %p of size %lu is not a block of the arena\n", bp, (unsigned long)size);
+		return -1;
+	}
+	if (arena_of(bp) != ar)
 	{
-		printf("Error: %p is not doubleword aligned\n", bp);
-		Assert(0==1);
+		printf("Error: %p is not owned by its arena\n", bp);
+		errors++;
 	}
-	if (GET(HDRP(bp)) != GET(FTRP(bp)))
+	if (!GET_ALLOC(HDRP(bp)) && (GET_SIZE(FTRP(bp)) != size || GET_ALLOC(FTRP(bp))))
 	{
-		printf("Error: header does not match footer\n");
-		Assert(0==1);
+		printf("Error: header of %p does not match footer\n", bp);
+		errors++;
 	}
+	/* Check that the next block knows whether this one is allocated */
+	if (!GET_ALLOC(HDRP(bp)) != !GET_PREV_ALLOC(HDRP(next)))
+	{
+		printf("Error: prev-allocated bit wrong after %p\n", bp);
+		errors++;
+	}
+	/* Check if two blocks next to each other are free (unless too big to merge) */
+	if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(next)) &&
+		GET_SIZE(HDRP(next)) <= MAX_BLOCK - size)
+	{
+		printf("Error: free blocks %p and %p are not coalesced\n", bp, next);
+		errors++;
+	}
+	return errors;
 }
 
-/* Return the appropriate list index for a given size */
-
 /*
-#define LIST_0_SIZE (unsigned int)(50)
-#define LIST_1_SIZE (unsigned int)(200)
-#define LIST_2_SIZE (unsigned int)(750)
-#define LIST_3_SIZE (unsigned int)(2000)
-#define LIST_4_SIZE (unsigned int)(5000)
-#define LIST_5_SIZE (unsigned int)(20000)
-#define LIST_6_SIZE (unsigned int)(50000)
-#define LIST_7_SIZE (unsigned int)(100000)
-*/
+ * get_index - Return the list a free block of this size belongs in.
+ */
+static void get_index(size_t size, int *fl, int *sl)
+{
+	int k = size < LARGE_BLOCK ? class_of[size / DSIZE] : tlsf_index(size);
+
+	*fl = k >> SL_LOG2;
+	*sl = k & (SL_COUNT - 1);
+}
 
-static int get_index(size_t size)
+/*
+ * get_fit_index - Return the first list every block of which is at least
+ * size bytes. Past the last list, fl is FL_COUNT.
+ */
+static void get_fit_index(size_t size, int *fl, int *sl)
 {
-	int index = 0;
-	if (size < LIST_0_SIZE) {
-		index = 0;
-	}
-	else if (size < LIST_2_SIZE){
-		index = 1;
-	}
-	else if (size < LIST_2_SIZE){
-		index = 2;
-	}
-	else if (size < LIST_3_SIZE){
-		index = 3;
-	}
-	else if (size < LIST_4_SIZE){
-		index = 4;
-	}
-	else if (size < LIST_5_SIZE){
-		index = 5;
+	int k, top;
+
+	if (size < LARGE_BLOCK)
+		k = class_fit[size / DSIZE];
+	else {
+		/* Round up to the next list boundary, as the TLSF layout does */
+		top = 8*sizeof(unsigned long) - 1 - __builtin_clzl(size);
+		k = tlsf_index(size + (1UL << (top - SL_LOG2)) - 1);
 	}
-	else if (size < LIST_6_SIZE){
-		index = 6;
-	}
-	else{
-		index = 7;
+
+	*fl = k >> SL_LOG2;
+	*sl = k & (SL_COUNT - 1);
+}
+
+/*
+ * tlsf_index - Below SMALL_BLOCK every list holds one size; above it, the
+ * first level is the position of the top bit and the second level is the
+ * next SL_LOG2 bits of the size.
+ */
+static int tlsf_index(size_t size)
+{
+	int top;
+
+	if (size < SMALL_BLOCK)
+		return size / (SMALL_BLOCK / SL_COUNT);
+	top = 8*sizeof(unsigned long) - 1 - __builtin_clzl(size);
+	return ((top - (FL_SHIFT - 1)) << SL_LOG2) + ((size >> (top - SL_LOG2)) ^ SL_COUNT);
+}
+
+/*
+ * classes_init - Build the class tables. With classes from
+ * mm_size_classes a block goes in the last class starting at or below its
+ * size, and a fit search starts at the class a size begins, or else the
+ * next one. The TLSF layout rounds the size up to the next list boundary
+ * for the fit instead.
+ */
+static void classes_init(void)
+{
+	size_t size;
+	int i, k = 0, top;
+
+	for (i = 0; i < CLASS_SLOTS; i++) {
+		size = (size_t)i * DSIZE;
+		if (class_count > 0) {
+			while (k + 1 < class_count && class_lo[k + 1] <= size)
+				k++;
+			class_of[i] = k;
+			class_fit[i] = class_lo[k] == size ? k : k + 1;
+			continue;
+		}
+		class_of[i] = tlsf_index(size);
+		if (size >= SMALL_BLOCK) {
+			top = 8*sizeof(unsigned long) - 1 - __builtin_clzl(size);
+			size += (1UL << (top - SL_LOG2)) - 1;
+		}
+		class_fit[i] = tlsf_index(size);
 	}
-	return index;
-}
\ No newline at end of file
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+
+extern int mm_init (void);
+extern void *mm_malloc (size_t size);
+extern void mm_free (void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+
+/* 
+ * mm_calloc - Allocate zeroed space for an array of nmemb objects of
+ * size bytes each. Returns NULL if the total overflows.
+ */
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/* 
+ * mm_memalign - Allocate size bytes aligned to a multiple of alignment,
+ * which is rounded up to a power of two. Free with mm_free.
+ */
+extern void *mm_memalign(size_t alignment, size_t size);
+
+/* 
+ * mm_aligned_alloc - As mm_memalign, but returns NULL unless alignment
+ * is a power of two.
+ */
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/* 
+ * mm_free_sized - Free a block, given the size it was allocated or last
+ * reallocated with. Faster than mm_free for small blocks.
+ */
+extern void mm_free_sized(void *ptr, size_t size);
+
+/* 
+ * mm_usable_size - Return how many bytes of payload a block really has.
+ * All of them may be used without calling mm_realloc.
+ */
+extern size_t mm_usable_size(void *ptr);
+
+/* 
+ * mm_footprint - Return how many bytes the allocator holds from the
+ * system: heap and mapped blocks together.
+ */
+extern size_t mm_footprint(void);
+
+/* Size classes of struct mm_stats: class k counts blocks of 2^k bytes
+   up to, but not including, 2^(k+1) */
+#define MM_STATS_CLASSES	64
+
+/* Most blocks a fit search walks down its own list */
+#define MM_FIT_SCAN	8
+
+struct mm_stats {
+	unsigned long mallocs[MM_STATS_CLASSES];	/* Blocks handed out, by block size */
+	unsigned long frees[MM_STATS_CLASSES];	/* Blocks given back, by block size */
+	unsigned long free_blocks[MM_STATS_CLASSES];	/* Blocks in the free lists, by size */
+	size_t free_bytes[MM_STATS_CLASSES];	/* Bytes in those blocks */
+	unsigned long tcache_hits;	/* Allocations served by the thread cache */
+	unsigned long tcache_misses;	/* Cacheable allocations that were not */
+	unsigned long realloc_inplace;	/* mm_realloc calls that resized in place */
+	unsigned long realloc_copies;	/* mm_realloc calls that had to copy */
+	unsigned long realloc_copied;	/* Payload bytes mm_realloc copied or slid down */
+	unsigned long realloc_saved;	/* Payload bytes it resized in place without moving */
+	unsigned long extends;		/* Times an arena grew the heap */
+	unsigned long fits;		/* Free list searches that found a block */
+	unsigned long fit_exact;	/* Of those, found in the list of their own size */
+	unsigned long fit_excess;	/* Bytes those blocks were over the size, summed */
+	unsigned long fit_scans[MM_FIT_SCAN + 1];	/* Own list walks, by blocks looked at */
+	size_t heap_bytes;		/* mm_footprint() now */
+	size_t peak_heap_bytes;		/* Most mm_footprint() has been */
+	size_t live_bytes;		/* Bytes of blocks handed out and not given back */
+	size_t peak_live_bytes;		/* Most live_bytes seen as the heap grew */
+	size_t largest_free;		/* Largest block in the free lists */
+	double fragmentation;		/* 1 - largest_free / free bytes, 0 if none free */
+};
+
+/* 
+ * mm_stats - Fill in *st with counts since mm_init and the state of the
+ * free lists now. Sizes include block headers.
+ */
+extern void mm_stats(struct mm_stats *st);
+
+/* 
+ * mm_profile_dump - Write the heap profile to path, or to
+ * mm.<pid>.<n>.heap if path is NULL, for pprof to read. Returns 0 on
+ * success and -1 on error or if the profiler was compiled out.
+ */
+extern int mm_profile_dump(const char *path);
+
+/* 
+ * mm_check - Verify the whole heap in one linear pass, printing each
+ * problem and then tripping Assert. Nothing else may use the allocator
+ * meanwhile.
+ */
+extern void mm_check(int verbose);
+
+/* 
+ * mm_check_step - Verify the next blocks heap blocks, resuming where the
+ * last call stopped. Safe alongside other threads. Returns -1 if a
+ * problem was found, 1 when a pass over the whole heap is complete, else 0.
+ */
+extern int mm_check_step(size_t blocks);
+
+/* 
+ * mm_size_classes - Start the free list classes at these request sizes,
+ * in increasing order, from the next mm_init on; n = 0 restores the
+ * default. Returns 0, or -1 if the table cannot be used. mkclasses
+ * builds tables from traces.
+ */
+extern int mm_size_classes(const size_t *bounds, int n);
+
+/* 
+ * mm_malloc_batch - Allocate n blocks of size bytes each into out[].
+ * Returns how many were allocated, less than n only if memory ran out.
+ */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/* 
+ * mm_free_batch - Free the n blocks in ptrs[], which may hold NULLs.
+ * ptrs[] is sorted by address as a side effect.
+ */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* 
+ * mm_mallopt - Tune the allocator, in the spirit of mallopt(3).
+ * Returns 1 if the value was accepted and 0 if not.
+ */
+extern int mm_mallopt(int param, int value);
+
+/* 
+ * mm_trim - Give free memory back to the system, leaving pad bytes free
+ * at the end of the heap. Returns 1 if any memory was released.
+ */
+extern int mm_trim(size_t pad);
+
+/* 
+ * mm_atfork_prepare, mm_atfork_parent, mm_atfork_child - Handlers for
+ * pthread_atfork that hold every allocator lock across fork(), for a
+ * process that forks while other threads allocate.
+ */
+extern void mm_atfork_prepare(void);
+extern void mm_atfork_parent(void);
+extern void mm_atfork_child(void);
+
+/* mm_mallopt parameters */
+#define M_MMAP_THRESHOLD	1	/* Requests of this many bytes and up get their own mapping */
+#define M_TRIM_THRESHOLD	2	/* mm_free trims after freeing this many bytes, -1 never */
+#define M_TOP_PAD		3	/* Free bytes an automatic trim leaves at the heap end */
+#define M_GROW_MIN		4	/* Smallest heap extension, used by mm_init */
+#define M_GROW_MAX		5	/* Largest heap extension */
+#define M_PREFAULT		6	/* Nonzero: touch new heap pages as they are added */
+#define M_ARENA_MAX		7	/* Arenas threads are spread over, set before threads start */
+#define M_DEFER_COALESCE	8	/* Small frees wait on quick lists, up to this many per arena; 0 off */
+#define M_PROFILE_RATE		9	/* Sample the heap about once every this many bytes; 0 off */
+#define M_PROFILE_SIGNAL	10	/* This signal makes the next sample dump the profile; 0 none */
+
+/*
+ * Inline fast path. mm_malloc of a nonzero size the compiler knows,
+ * small enough for the thread cache, is worked out to a cache
+ * bin at compile time and pops that bin right here. An empty bin, and
+ * every other request, calls mm_malloc in mm.c. These definitions must
+ * match the mm.c linked in, so build both with the same WIDE_HEAP.
+ * Define MM_NO_FAST_PATH to always make the call.
+ */
+#ifndef WIDE_HEAP
+#define WIDE_HEAP	0
+#endif
+#if WIDE_HEAP
+#define MM_WSIZE	8	/* Header word */
+#else
+#define MM_WSIZE	4
+#endif
+#define MM_DSIZE	(2*MM_WSIZE)	/* Block alignment */
+#define MM_CACHE_MAX	512	/* Largest block size the thread cache keeps */
+#define MM_CACHE_BINS	(MM_CACHE_MAX/MM_DSIZE + 1)	/* One bin per block size */
+
+/* Cache bin of a request: its block size, header and alignment included,
+   in doublewords. Folds to a constant for a constant size */
+#define MM_CLASS(size)	((size) <= 3*MM_WSIZE ? 2 : \
+	((size) + MM_WSIZE + (MM_DSIZE-1)) / MM_DSIZE)
+
+struct mm_cache_bin {
+	void *head;		/* Cached blocks, linked through their first word */
+	unsigned int count;
+	unsigned long fast_hits;	/* Blocks the fast path took, for mm_stats */
+};
+
+/* A thread's cache of freed blocks, binned by exact block size */
+struct mm_cache {
+	struct mm_cache_bin bins[MM_CACHE_BINS];
+	unsigned int gen;	/* mm_heap_gen the cached blocks belong to */
+	long countdown;		/* Bytes to allocate before the next profile sample */
+	unsigned long fast_bytes;	/* Bytes of the blocks the fast path took */
+};
+
+extern __thread struct mm_cache mm_cache;
+extern unsigned int mm_heap_gen;	/* Bumped by mm_init */
+
+/* 
+ * mm_malloc_cached - Take a block of cache bin cls for a request of size
+ * bytes, or leave it to mm_malloc.
+ */
+static inline void *mm_malloc_cached(size_t size, unsigned int cls)
+{
+	struct mm_cache_bin *bin = &mm_cache.bins[cls];
+	void *bp = bin->head;
+	long bytes = cls * MM_DSIZE;
+
+	/* Bins of an old heap, and the block due to be sampled, go the slow way */
+	if (__builtin_expect(bp == NULL || mm_cache.gen != mm_heap_gen ||
+		mm_cache.countdown < bytes, 0))
+		return (mm_malloc)(size);
+	bin->head = *(void **)bp;
+	bin->count--;
+	/* mm_stats reads the counts from other threads */
+	__atomic_store_n(&bin->fast_hits, bin->fast_hits + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&mm_cache.fast_bytes, mm_cache.fast_bytes + bytes, __ATOMIC_RELAXED);
+	mm_cache.countdown -= bytes;
+	return bp;
+}
+
+#if defined(__GNUC__) && !defined(MM_NO_FAST_PATH)
+#define mm_malloc(size)	(__builtin_constant_p(size) && (size) > 0 && \
+	MM_CLASS(size) * MM_DSIZE <= MM_CACHE_MAX ? \
+	mm_malloc_cached((size), MM_CLASS(size)) : (mm_malloc)(size))
+#endif
+
+/* 
+ * Students work in teams of one or two.  Teams enter their team name, 
+ * personal names and login IDs in a struct of this
+ * type in their bits.c file.
+ */
+typedef struct {
+    char *teamname; /* ID1+ID2 or ID1 */
+    char *name1;    /* full name of first member */
+    char *id1;      /* login ID of first member */
+    char *name2;    /* full name of second member (if any) */
+    char *id2;      /* login ID of second member */
+} team_t;
+
+extern team_t team;
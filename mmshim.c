@@ -0,0 +1,203 @@
+/*
+ * mmshim.c - The standard allocation functions on top of mm.c, built into
+ * libmm.so so unmodified programs can run on this allocator:
+ *
+ *	LD_PRELOAD=./libmm.so program
+ *
+ * The heap is memlib's single mmap reservation in place of the process
+ * break. The first call may come from the dynamic loader or a constructor
+ * long before main, so memlib and mm.c are set up lazily, under a lock, by
+ * whichever thread allocates first. After that the fork handlers are
+ * registered, which hold every allocator lock across fork() so the child
+ * finds the heap consistent.
+ *
+ * Only the functions below are exported; the mm_* and mem_* functions
+ * stay hidden inside the library.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT	__attribute__((visibility("default")))
+
+static int ready;	/* mm_init has run */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set up on the first call, then take the fast way */
+#define INIT()	(__atomic_load_n(&ready, __ATOMIC_ACQUIRE) || shim_init() == 0)
+
+/*
+ * shim_init - Reserve the heap and initialize the allocator. Nothing in
+ * here allocates. pthread_atfork might, so it is called once the
+ * allocator is ready and outside the lock.
+ */
+static int shim_init(void)
+{
+	int fresh = 0;
+
+	pthread_mutex_lock(&init_lock);
+	if (!ready) {
+		mem_init();
+		if (mm_init() < 0) {
+			pthread_mutex_unlock(&init_lock);
+			return -1;
+		}
+		__atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+		fresh = 1;
+	}
+	pthread_mutex_unlock(&init_lock);
+	if (fresh)
+		pthread_atfork(mm_atfork_prepare, mm_atfork_parent, mm_atfork_child);
+	return 0;
+}
+
+EXPORT void *malloc(size_t size)
+{
+	void *p;
+
+	if (size > PTRDIFF_MAX || !INIT()) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* malloc(0) must return a pointer that free accepts; give a small one */
+	if ((p = mm_malloc(size ? size : 1)) == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+EXPORT void free(void *ptr)
+{
+	/* Nothing can have been allocated before the first call */
+	if (ptr != NULL && ready)
+		mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (nmemb == 0 || size == 0)
+		nmemb = size = 1;
+	if (size > PTRDIFF_MAX / nmemb || !INIT()) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ((p = mm_calloc(nmemb, size)) == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+/*
+ * realloc - As glibc: a NULL pointer is malloc, and a zero size frees
+ * the block and returns NULL.
+ */
+EXPORT void *realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if (ptr == NULL)
+		return malloc(size);
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+	if (size > PTRDIFF_MAX) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ((p = mm_realloc(ptr, size)) == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+/*
+ * reallocarray - glibc's own reallocarray calls its internal realloc,
+ * which would be handed a block of ours, so it has to be replaced too.
+ */
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > PTRDIFF_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc(ptr, nmemb * size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	if (size > PTRDIFF_MAX || !INIT())
+		return ENOMEM;
+	if ((p = mm_memalign(alignment, size ? size : 1)) == NULL)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+	void *p;
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (size > PTRDIFF_MAX || !INIT()) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ((p = mm_aligned_alloc(alignment, size ? size : 1)) == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+/*
+ * memalign - Obsolete, but still used. Any alignment is accepted and
+ * rounded up to a power of two.
+ */
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+	void *p;
+
+	if (size > PTRDIFF_MAX || !INIT()) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ((p = mm_memalign(alignment, size ? size : 1)) == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+EXPORT void *valloc(size_t size)
+{
+	return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	if (size > PTRDIFF_MAX - page) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+	return ptr != NULL && ready ? mm_usable_size(ptr) : 0;
+}
+
+EXPORT int malloc_trim(size_t pad)
+{
+	return ready ? mm_trim(pad) : 0;
+}
@@ -0,0 +1,543 @@
+/*
+ * mtbench.c - Multi-threaded benchmarks for the memory manager.
+ *
+ * Runs five workloads over a sweep of thread counts, against mm and
+ * against the C library malloc as a baseline:
+ *
+ *   larson	 Larson server simulation. Each thread replaces random
+ *		 blocks in its own array; between rounds the arrays move on
+ *		 to the next thread, so blocks are freed by threads that did
+ *		 not allocate them.
+ *   prodcons	 Threads in pairs: one allocates and passes blocks through
+ *		 a ring, the other frees them. Every free is a remote free.
+ *   threadtest	 Hoard's threadtest. A fixed amount of work split between
+ *		 the threads: allocate a batch of small blocks, free it all.
+ *   batch	 threadtest with each batch allocated by one
+ *		 mm_malloc_batch and freed by one mm_free_batch, to set
+ *		 against threadtest's single calls. The C library has no
+ *		 batch calls, so its runs loop over malloc and free.
+ *   falseshare	 Hoard's active-false. Each thread allocates a small block,
+ *		 writes it many times and frees it. Blocks of different
+ *		 threads sharing a cache line slow every write.
+ *
+ * Every run reports throughput, peak RSS growth over the run (sampled
+ * from /proc/self/statm) and scaling efficiency: throughput over the
+ * one-thread throughput times the thread count.
+ *
+ * Usage: mtbench [-a mm|libc|both] [-b bench] [-t threads,...] [-s secs] [-A arenas]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAXTHREADS	256	/* Most threads in one run */
+#define MAXSWEEP	32	/* Most thread counts in one sweep */
+#define LARSON_SLOTS	1000	/* Blocks each larson thread keeps live */
+#define LARSON_ROUNDS	8	/* Times the arrays move on per run */
+#define RING_SIZE	1024	/* Blocks in flight per producer/consumer pair */
+#define TT_TOTAL	(1 << 22)	/* threadtest blocks, split among the threads */
+#define TT_BATCH	1000	/* threadtest blocks per batch */
+#define FS_WRITES	1000	/* falseshare writes per block */
+
+/* The allocator being measured */
+typedef struct {
+	const char *name;
+	void *(*malloc)(size_t size);
+	void (*free)(void *ptr);
+	size_t (*malloc_batch)(size_t size, size_t n, void **out);	/* Or NULL */
+	void (*free_batch)(void **ptrs, size_t n);
+} impl_t;
+
+/* A benchmark: runs nthreads threads and returns operations done */
+typedef struct {
+	const char *name;
+	double (*run)(impl_t *impl, int nthreads, double secs, double *elapsed);
+} bench_t;
+
+/* Per-thread state, padded so the harness causes no false sharing */
+typedef struct {
+	impl_t *impl;
+	int id;
+	int nthreads;
+	unsigned int seed;
+	double secs;		/* Run length, for threads that time themselves */
+	unsigned long ops;
+	char pad[64];
+} worker_t;
+
+/* A single-producer single-consumer ring of blocks */
+typedef struct {
+	void *slot[RING_SIZE];
+	unsigned long head __attribute__((aligned(64)));	/* Next slot to fill */
+	unsigned long tail __attribute__((aligned(64)));	/* Next slot to empty */
+} ring_t;
+
+static volatile int stop;	/* Set when a timed run is over */
+static pthread_barrier_t barrier;
+static void **larson_arrays[MAXTHREADS];
+static ring_t *rings;
+
+static impl_t mm_impl = { "mm", mm_malloc, mm_free, mm_malloc_batch, mm_free_batch };
+static impl_t libc_impl = { "libc", malloc, free, NULL, NULL };
+
+/* Function prototypes for internal helper routines */
+static double run_larson(impl_t *impl, int nthreads, double secs, double *elapsed);
+static double run_prodcons(impl_t *impl, int nthreads, double secs, double *elapsed);
+static double run_threadtest(impl_t *impl, int nthreads, double secs, double *elapsed);
+static double run_batch(impl_t *impl, int nthreads, double secs, double *elapsed);
+static double run_falseshare(impl_t *impl, int nthreads, double secs, double *elapsed);
+static void *larson_thread(void *arg);
+static void *producer_thread(void *arg);
+static void *consumer_thread(void *arg);
+static void *threadtest_thread(void *arg);
+static void *batch_thread(void *arg);
+static void *falseshare_thread(void *arg);
+static double run_threads(impl_t *impl, worker_t *w, int nthreads, void *(*fn)(void *), double secs);
+static void *rss_sampler(void *arg);
+static size_t rss_bytes(void);
+static size_t rand_size(unsigned int *seed);
+static double now(void);
+static void usage(const char *prog);
+
+static bench_t benches[] = {
+	{ "larson", run_larson },
+	{ "prodcons", run_prodcons },
+	{ "threadtest", run_threadtest },
+	{ "batch", run_batch },
+	{ "falseshare", run_falseshare },
+};
+#define NBENCHES	(int)(sizeof(benches) / sizeof(benches[0]))
+
+/* Peak RSS seen by the sampler during a run */
+static volatile size_t rss_peak;
+static volatile int sampling;
+
+int main(int argc, char **argv)
+{
+	int sweep[MAXSWEEP] = { 1, 2, 4, 8 };
+	int nsweep = 4, use_mm = 1, use_libc = 1, arenas = 0;
+	const char *only = NULL;
+	double secs = 0.5, elapsed, ops, base = 0;
+	impl_t *impls[2];
+	int nimpls = 0, b, i, k, c;
+	char *tok;
+	size_t rss0;
+	pthread_t sampler;
+
+	while ((c = getopt(argc, argv, "a:b:t:s:A:h")) != -1) {
+		switch (c) {
+		case 'a':
+			use_mm = strcmp(optarg, "libc") != 0;
+			use_libc = strcmp(optarg, "mm") != 0;
+			break;
+		case 'b':
+			only = optarg;
+			break;
+		case 't':
+			for (nsweep = 0, tok = strtok(optarg, ","); tok != NULL && nsweep < MAXSWEEP;
+				tok = strtok(NULL, ","))
+				if ((sweep[nsweep++] = atoi(tok)) < 1 || sweep[nsweep-1] > MAXTHREADS)
+					usage(argv[0]);
+			break;
+		case 's':
+			if ((secs = atof(optarg)) <= 0)
+				usage(argv[0]);
+			break;
+		case 'A':
+			arenas = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (use_mm)
+		impls[nimpls++] = &mm_impl;
+	if (use_libc)
+		impls[nimpls++] = &libc_impl;
+
+	mem_init();
+	if (arenas > 0 && !mm_mallopt(M_ARENA_MAX, arenas)) {
+		fprintf(stderr, "Bad arena count %d\n", arenas);
+		exit(1);
+	}
+	printf("%-11s %-5s %7s %12s %10s %8s\n", "bench", "impl", "threads",
+		"ops/s", "RSS+ KB", "scaling");
+	for (b = 0; b < NBENCHES; b++) {
+		if (only != NULL && strcmp(only, benches[b].name) != 0)
+			continue;
+		for (i = 0; i < nimpls; i++) {
+			for (k = 0; k < nsweep; k++) {
+				if (impls[i] == &mm_impl) {
+					mem_reset_brk();
+					if (mm_init() < 0) {
+						fprintf(stderr, "mm_init failed\n");
+						exit(1);
+					}
+				}
+				rss0 = rss_bytes();
+				rss_peak = rss0;
+				sampling = 1;
+				pthread_create(&sampler, NULL, rss_sampler, NULL);
+				ops = benches[b].run(impls[i], sweep[k], secs, &elapsed);
+				sampling = 0;
+				pthread_join(sampler, NULL);
+
+				ops /= elapsed;
+				if (sweep[k] == 1 || k == 0)
+					base = ops / sweep[k];
+				printf("%-11s %-5s %7d %12.0f %10lu %7.0f%%\n", benches[b].name,
+					impls[i]->name, sweep[k], ops,
+					(unsigned long)((rss_peak > rss0 ? rss_peak - rss0 : 0) >> 10),
+					100.0 * ops / (base * sweep[k]));
+				fflush(stdout);
+			}
+		}
+	}
+	mem_deinit();
+	return 0;
+}
+
+/*
+ * run_larson - Each thread owns an array of LARSON_SLOTS blocks and
+ * replaces random ones for a while. Then every array moves to the next
+ * thread, which frees what the last owner allocated.
+ */
+static double run_larson(impl_t *impl, int nthreads, double secs, double *elapsed)
+{
+	worker_t w[MAXTHREADS];
+	double ops = 0;
+	int i, j;
+
+	for (i = 0; i < nthreads; i++)
+		larson_arrays[i] = calloc(LARSON_SLOTS, sizeof(void *));
+	*elapsed = run_threads(impl, w, nthreads, larson_thread, secs);
+	for (i = 0; i < nthreads; i++) {
+		ops += w[i].ops;
+		for (j = 0; j < LARSON_SLOTS; j++)
+			impl->free(larson_arrays[i][j]);
+		free(larson_arrays[i]);
+	}
+	return ops;
+}
+
+static void *larson_thread(void *arg)
+{
+	worker_t *w = arg;
+	int round, k, mine = w->id;
+	double end, round_secs = w->secs / LARSON_ROUNDS;
+	void **slots;
+
+	for (round = 0; round < LARSON_ROUNDS; round++) {
+		slots = larson_arrays[mine];
+		end = now() + round_secs;
+		while (now() < end) {
+			for (k = 0; k < 64; k++) {
+				int i = rand_r(&w->seed) % LARSON_SLOTS;
+
+				w->impl->free(slots[i]);
+				slots[i] = w->impl->malloc(rand_size(&w->seed));
+				if (slots[i] != NULL)
+					*(char *)slots[i] = 1;
+			}
+			w->ops += 2 * 64;
+		}
+		/* Hand the array on; the next owner frees these blocks */
+		pthread_barrier_wait(&barrier);
+		mine = (mine + 1) % w->nthreads;
+		pthread_barrier_wait(&barrier);
+	}
+	return NULL;
+}
+
+/*
+ * run_prodcons - Threads pair up as producer and consumer over a ring.
+ * An odd thread count leaves the last thread alone with a ring, which
+ * it both fills and empties.
+ */
+static double run_prodcons(impl_t *impl, int nthreads, double secs, double *elapsed)
+{
+	worker_t w[MAXTHREADS];
+	double ops = 0;
+	int i;
+	unsigned long k;
+
+	rings = calloc((nthreads + 1) / 2, sizeof(ring_t));
+	*elapsed = run_threads(impl, w, nthreads, producer_thread, secs);
+	for (i = 0; i < nthreads; i++)
+		ops += w[i].ops;
+	for (i = 0; i < (nthreads + 1) / 2; i++)
+		for (k = rings[i].tail; k != rings[i].head; k++)
+			impl->free(rings[i].slot[k % RING_SIZE]);
+	free(rings);
+	return ops;
+}
+
+static void *producer_thread(void *arg)
+{
+	worker_t *w = arg;
+	ring_t *ring = &rings[w->id / 2];
+	int alone = w->id + 1 == w->nthreads;
+	unsigned long head, tail;
+	void *bp;
+
+	if (w->id % 2 == 1)
+		return consumer_thread(arg);
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		head = ring->head;
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - tail == RING_SIZE) {
+			/* Wait for the consumer, or be it if there is none */
+			if (!alone) {
+				sched_yield();
+				continue;
+			}
+			w->impl->free(ring->slot[tail % RING_SIZE]);
+			ring->tail = tail + 1;
+			w->ops++;
+		}
+		if ((bp = w->impl->malloc(rand_size(&w->seed))) == NULL)
+			continue;
+		*(char *)bp = 1;
+		ring->slot[head % RING_SIZE] = bp;
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+		w->ops++;
+	}
+	return NULL;
+}
+
+/*
+ * consumer_thread - Free blocks from the ring as they come.
+ */
+static void *consumer_thread(void *arg)
+{
+	worker_t *w = arg;
+	ring_t *ring = &rings[w->id / 2];
+	unsigned long tail;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		tail = ring->tail;
+		if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+			sched_yield();
+			continue;
+		}
+		w->impl->free(ring->slot[tail % RING_SIZE]);
+		__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+		w->ops++;
+	}
+	return NULL;
+}
+
+/*
+ * run_threadtest - TT_TOTAL blocks in batches, split evenly among the
+ * threads. The work is fixed, so secs is not used.
+ */
+static double run_threadtest(impl_t *impl, int nthreads, double secs, double *elapsed)
+{
+	worker_t w[MAXTHREADS];
+	double ops = 0;
+	int i;
+
+	(void)secs;
+	*elapsed = run_threads(impl, w, nthreads, threadtest_thread, 0);
+	for (i = 0; i < nthreads; i++)
+		ops += w[i].ops;
+	return ops;
+}
+
+static void *threadtest_thread(void *arg)
+{
+	worker_t *w = arg;
+	void *batch[TT_BATCH];
+	long left;
+	int i;
+
+	pthread_barrier_wait(&barrier);
+	for (left = TT_TOTAL / w->nthreads; left > 0; left -= TT_BATCH) {
+		for (i = 0; i < TT_BATCH; i++)
+			if ((batch[i] = w->impl->malloc(64)) != NULL)
+				*(char *)batch[i] = 1;
+		for (i = 0; i < TT_BATCH; i++)
+			w->impl->free(batch[i]);
+		w->ops += 2 * TT_BATCH;
+	}
+	return NULL;
+}
+
+/*
+ * run_batch - threadtest's work, a batch per call.
+ */
+static double run_batch(impl_t *impl, int nthreads, double secs, double *elapsed)
+{
+	worker_t w[MAXTHREADS];
+	double ops = 0;
+	int i;
+
+	(void)secs;
+	*elapsed = run_threads(impl, w, nthreads, batch_thread, 0);
+	for (i = 0; i < nthreads; i++)
+		ops += w[i].ops;
+	return ops;
+}
+
+static void *batch_thread(void *arg)
+{
+	worker_t *w = arg;
+	void *batch[TT_BATCH];
+	long left;
+	size_t n;
+	int i;
+
+	if (w->impl->malloc_batch == NULL)
+		return threadtest_thread(arg);
+	pthread_barrier_wait(&barrier);
+	for (left = TT_TOTAL / w->nthreads; left > 0; left -= TT_BATCH) {
+		n = w->impl->malloc_batch(64, TT_BATCH, batch);
+		for (i = 0; i < (int)n; i++)
+			*(char *)batch[i] = 1;
+		w->impl->free_batch(batch, n);
+		w->ops += 2 * TT_BATCH;
+	}
+	return NULL;
+}
+
+/*
+ * run_falseshare - Small blocks written hard by their owner thread.
+ * Reported ops are writes, so false sharing shows up as lost scaling.
+ */
+static double run_falseshare(impl_t *impl, int nthreads, double secs, double *elapsed)
+{
+	worker_t w[MAXTHREADS];
+	double ops = 0;
+	int i;
+
+	*elapsed = run_threads(impl, w, nthreads, falseshare_thread, secs);
+	for (i = 0; i < nthreads; i++)
+		ops += w[i].ops;
+	return ops;
+}
+
+static void *falseshare_thread(void *arg)
+{
+	worker_t *w = arg;
+	volatile char *bp;
+	int i;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		if ((bp = w->impl->malloc(8)) == NULL)
+			continue;
+		for (i = 0; i < FS_WRITES; i++)
+			bp[i & 7]++;
+		w->impl->free((void *)bp);
+		w->ops += FS_WRITES;
+	}
+	return NULL;
+}
+
+/*
+ * run_threads - Start nthreads workers on fn, and stop them after secs
+ * seconds if secs is not 0. Returns the seconds the run took. Larson
+ * threads time their own rounds and only use the barrier among
+ * themselves.
+ */
+static double run_threads(impl_t *impl, worker_t *w, int nthreads, void *(*fn)(void *), double secs)
+{
+	pthread_t tid[MAXTHREADS];
+	double start;
+	int i;
+
+	stop = 0;
+	pthread_barrier_init(&barrier, NULL, fn == larson_thread ? nthreads : nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		memset(&w[i], 0, sizeof(worker_t));
+		w[i].impl = impl;
+		w[i].id = i;
+		w[i].nthreads = nthreads;
+		w[i].seed = i + 1;
+		w[i].secs = secs;
+		pthread_create(&tid[i], NULL, fn, &w[i]);
+	}
+	start = now();
+	if (fn != larson_thread) {
+		pthread_barrier_wait(&barrier);
+		start = now();
+		if (secs > 0) {
+			struct timespec ts = { (time_t)secs, (long)((secs - (time_t)secs) * 1e9) };
+
+			nanosleep(&ts, NULL);
+			stop = 1;
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tid[i], NULL);
+	start = now() - start;
+	pthread_barrier_destroy(&barrier);
+	return start;
+}
+
+/*
+ * rss_sampler - Track the peak RSS every millisecond while a run lasts.
+ */
+static void *rss_sampler(void *arg)
+{
+	struct timespec ts = { 0, 1000000 };
+	size_t rss;
+
+	while (sampling) {
+		if ((rss = rss_bytes()) > rss_peak)
+			rss_peak = rss;
+		nanosleep(&ts, NULL);
+	}
+	return arg;
+}
+
+static size_t rss_bytes(void)
+{
+	FILE *fp = fopen("/proc/self/statm", "r");
+	unsigned long size, resident = 0;
+
+	if (fp == NULL)
+		return 0;
+	if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+	return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Mostly small sizes, as servers see them, with a tail up to 4 KB */
+static size_t rand_size(unsigned int *seed)
+{
+	unsigned int r = rand_r(seed);
+
+	if (r % 16 == 0)
+		return 512 + r % 3584;
+	return 8 + r % 248;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-a mm|libc|both] [-b bench] [-t threads,...] [-s secs] [-A arenas]\n", prog);
+	fprintf(stderr, "  -a  Allocator(s) to measure (default both)\n");
+	fprintf(stderr, "  -b  Run only larson, prodcons, threadtest, batch or falseshare\n");
+	fprintf(stderr, "  -t  Thread counts to sweep (default 1,2,4,8)\n");
+	fprintf(stderr, "  -s  Seconds per timed run (default 0.5)\n");
+	fprintf(stderr, "  -A  Arenas for mm (M_ARENA_MAX, default one per CPU)\n");
+	exit(1);
+}
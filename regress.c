@@ -0,0 +1,142 @@
+/*
+ * regress.c - Regression checks for allocator bugs that the traces in
+ * traces/ cannot reach, because they need mm_mallopt or pointers no
+ * trace would produce. Each check prints what it tried; the exit status
+ * is the number that failed. Run with make check.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Function prototypes for the checks */
+static int realloc_mapped_below_threshold(void);
+static int realloc_outside_heap(void);
+static int trim_twice(void);
+static int free_sized_live(void);
+
+/* Every check, in the order run */
+static struct {
+	const char *name;
+	int (*run)(void);
+} checks[] = {
+	{ "realloc of a mapped block below a raised threshold", realloc_mapped_below_threshold },
+	{ "realloc of a pointer outside the heap", realloc_outside_heap },
+	{ "mm_trim with nothing left to release", trim_twice },
+	{ "live bytes after freeing everything with mm_free_sized", free_sized_live },
+};
+
+int main(void)
+{
+	size_t i;
+	int failed = 0, ok;
+
+	mem_init();
+	for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+		mem_reset_brk();
+		if (mm_init() < 0) {
+			fprintf(stderr, "mm_init failed\n");
+			return 1;
+		}
+		ok = checks[i].run();
+		printf("%-60s %s\n", checks[i].name, ok ? "ok" : "FAILED");
+		failed += !ok;
+	}
+	mem_deinit();
+	return failed;
+}
+
+/*
+ * realloc_mapped_below_threshold - Grow a mapped block after raising
+ * M_MMAP_THRESHOLD above the new size. It moves into the heap, and only
+ * the old payload may be copied.
+ */
+static int realloc_mapped_below_threshold(void)
+{
+	size_t old = 200 << 10, i;
+	unsigned char *p, *q;
+	int ok = 1;
+
+	mm_mallopt(M_MMAP_THRESHOLD, 128 << 10);
+	if ((p = mm_malloc(old)) == NULL)
+		return 0;
+	memset(p, 0xa5, old);
+	mm_mallopt(M_MMAP_THRESHOLD, 4 << 20);
+	if ((q = mm_realloc(p, 3 << 20)) == NULL)
+		return 0;
+	for (i = 0; i < old; i++)
+		if (q[i] != 0xa5) {
+			ok = 0;
+			break;
+		}
+	mm_free(q);
+	mm_mallopt(M_MMAP_THRESHOLD, 128 << 10);
+	return ok;
+}
+
+/*
+ * realloc_outside_heap - A pointer the allocator never handed out, with
+ * a plausible header in front of it, must be refused, not followed.
+ */
+static int realloc_outside_heap(void)
+{
+	static long buf[8];
+
+	buf[1] = 64;
+	return mm_realloc(&buf[2], 1000) == NULL;
+}
+
+/*
+ * trim_twice - A big free block in the middle of the heap is purged by
+ * the first mm_trim, if mm_free has not already done it. The second trim
+ * finds nothing left to give back, and must say so.
+ */
+static int trim_twice(void)
+{
+	void *p, *q;
+	int released;
+
+	mm_mallopt(M_MMAP_THRESHOLD, 4 << 20);
+	p = mm_malloc(1 << 20);
+	q = mm_malloc(64);
+	if (p == NULL || q == NULL)
+		return 0;
+	mm_free(p);
+	mm_trim(0);
+	released = mm_trim(0);
+	mm_free(q);
+	mm_mallopt(M_MMAP_THRESHOLD, 128 << 10);
+	return released == 0;
+}
+
+/*
+ * free_sized_live - Churn enough blocks of enough sizes that the thread
+ * cache overflows into the free lists, and some blocks are placed in free
+ * blocks a little bigger than asked for, then free every one with
+ * mm_free_sized. The blocks must be counted out at the size they were
+ * counted in, leaving no live bytes.
+ */
+static int free_sized_live(void)
+{
+	void *p[4096];
+	size_t size[4096];
+	struct mm_stats st;
+	unsigned int seed = 1;
+	int i, k;
+
+	memset(p, 0, sizeof(p));
+	for (i = 0; i < 200000; i++) {
+		k = rand_r(&seed) % 4096;
+		if (p[k] != NULL)
+			mm_free_sized(p[k], size[k]);
+		size[k] = 17 + rand_r(&seed) % 480;
+		if ((p[k] = mm_malloc(size[k])) == NULL)
+			return 0;
+	}
+	for (k = 0; k < 4096; k++)
+		mm_free_sized(p[k], size[k]);
+	mm_stats(&st);
+	return st.live_bytes == 0;
+}